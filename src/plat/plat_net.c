@@ -5,6 +5,10 @@
  * under the terms of the MIT license. See LICENSE for details.
  */
 
+#ifdef __linux__
+#define _GNU_SOURCE             /* for syscall, accept4 */
+#endif
+
 #ifdef _WIN32
 #include <winsock2.h>
 #include <ws2tcpip.h>
@@ -17,6 +21,7 @@
 #include <sys/socket.h>
 #include <sys/ioctl.h>
 /* #include <netinet/in.h> */
+#include <netinet/tcp.h>
 #include <net/if.h>
 //#include <net/if_arp.h>
 #include <arpa/inet.h>
@@ -27,6 +32,31 @@
 #include <fcntl.h>
 #include <signal.h>
 #include <ctype.h>
+#include <limits.h>
+#include <sys/uio.h>
+
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+
+#ifdef __linux__
+#include <linux/sockios.h>      /* for SIOCOUTQNSD */
+#endif
+
+#if defined(__linux__) && !defined(MNET_NO_EPOLL)
+#define MNET_USE_EPOLL
+#include <sys/epoll.h>
+#endif
+
+#if defined(__linux__) && !defined(MNET_NO_IOURING) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define MNET_USE_IOURING
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <poll.h>
+#include <linux/io_uring.h>
+#endif
+#endif
 
 #endif
 
@@ -35,6 +65,7 @@
 #include <string.h>
 
 #include "plat_type.h"
+#include "plat_time.h"
 #include "plat_net.h"
 #include "m_mem.h"
 #include "m_debug.h"
@@ -64,6 +95,34 @@
 
 #endif  /* _WIN32 */
 
+#ifndef MNET_EPOLL_MAX_EVENTS
+#define MNET_EPOLL_MAX_EVENTS 1024
+#endif
+
+#ifndef MNET_RECV_QUANTUM
+#define MNET_RECV_QUANTUM (64*1024) /* bytes read per chann in one poll */
+#endif
+
+#ifndef MNET_ACCEPT_BUDGET
+#define MNET_ACCEPT_BUDGET 64    /* accepts per listener in one poll */
+#endif
+
+#ifndef MNET_TUNE_INTERVAL
+#define MNET_TUNE_INTERVAL 1000  /* ms between buffer autotune */
+#endif
+
+#ifndef MNET_URING_ENTRIES
+#define MNET_URING_ENTRIES 1024
+#endif
+
+#ifndef MNET_POOL_CAP_SIZE
+#define MNET_POOL_CAP_SIZE (1024*1024) /* free bytes kept per size class */
+#endif
+
+#ifndef MNET_URING_IOV_MAX
+#define MNET_URING_IOV_MAX 8     /* iovecs per send op */
+#endif
+
 enum {
    MNET_SET_READ,
    MNET_SET_WRITE,
@@ -71,20 +130,45 @@ enum {
    MNET_SET_MAX,
 };
 
+/* send buf size class */
+enum {
+   MNET_RWB_SMALL,
+   MNET_RWB_MEDIUM,
+   MNET_RWB_LARGE,
+   MNET_RWB_CLASS_MAX,
+   MNET_RWB_OWNED = MNET_RWB_CLASS_MAX, /* caller's buffer, not pooled */
+};
+
+static const int _rwb_class_size[MNET_RWB_CLASS_MAX] = {
+   2048, 16384, MNET_BUF_SIZE
+};
+
 typedef struct s_rwbuf {
    int ptr, ptw;
+   int size;
+   int cls;                     /* size class */
    struct s_rwbuf *next;
    char *buf;
+   chann_release_cb release;    /* for owned buf */
+   void *ud;
 } rwb_t;
 
+typedef struct s_rwbuf_pool {
+   rwb_t *free[MNET_RWB_CLASS_MAX];
+   int count[MNET_RWB_CLASS_MAX];
+} rwb_pool_t;
+
 typedef struct s_rwbuf_head {
    rwb_t *head;
    rwb_t *tail;
    int count;
+   int bytes;                   /* buffered bytes in chain */
+   rwb_pool_t *pool;
 } rwb_head_t;
 
 struct s_mchann {
    int fd;
+   struct s_mnet *ss;           /* owner context */
    void *opaque;
    chann_state_t state;
    chann_type_t type;
@@ -94,20 +178,132 @@ struct s_mchann {
    rwb_head_t rwb_send;         /* fifo */
    struct s_mchann *prev;
    struct s_mchann *next;
+   struct s_mchann *close_next; /* in closing list */
+   struct s_mchann *tfo_next;   /* in fastopen list */
+   int tfo_defer;               /* connect deferred for fast open */
+   struct s_mchann *cork_next;  /* in corked list */
+   int cork_size;               /* flush threshold, 0 not corked */
+   int cork_queued;             /* in corked list */
    int64_t bytes_send;
    int64_t bytes_recv;
    int active_send_event;
+   int active_recv_event;
+   int recv_drained;            /* last recv got less than asked */
+   int wm_low;                  /* send queue watermark */
+   int wm_high;
+   int wm_over;                 /* over high, wait low */
+   int accept_budget;           /* for listener */
+   int opt_val[MNET_OPT_MAX];   /* applied when socket opened */
+   unsigned opt_mask;
+   mnet_timer_t *tune_timer;    /* buffer autotune */
+   int64_t tune_ti;
+   int64_t tune_send;
+   int64_t tune_recv;
+   int ev_mask;                 /* events registered in epoll */
+#ifdef MNET_USE_IOURING
+   int uring_ops;               /* ops in flight */
+   int uring_dirty;             /* in dirty list */
+   int uring_zombie;            /* destroyed, wait ops complete */
+   struct s_mchann *dirty_next;
+   struct sockaddr_in acc_addr; /* for accept op */
+   socklen_t acc_len;
+   struct msghdr send_msg;      /* for send op */
+   struct iovec send_iov[MNET_URING_IOV_MAX];
+#endif
 };
 
+#ifdef MNET_USE_IOURING
+/* user_data = chann pointer | op */
+enum {
+   MNET_URING_OP_NONE = 0,
+   MNET_URING_OP_POLL_IN,
+   MNET_URING_OP_POLL_OUT,
+   MNET_URING_OP_SEND,
+   MNET_URING_OP_CONNECT,
+   MNET_URING_OP_ACCEPT,
+   MNET_URING_OP_CANCEL,
+   MNET_URING_OP_MASK = 7,
+};
+
+typedef struct {
+   int fd;
+   unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+   unsigned *cq_head, *cq_tail, *cq_mask;
+   unsigned sq_entries;
+   unsigned to_submit;
+   struct io_uring_sqe *sqes;
+   struct io_uring_cqe *cqes;
+   void *ring_ptr;
+   size_t ring_sz;
+   size_t sqes_sz;
+   chann_t *dirty;              /* channs need arm ops */
+   chann_t *zombie;             /* destroyed channs with ops in flight */
+} mnet_uring_t;
+#endif
+
+/* hierarchical timing wheel in ms tick, root covers 256 ms, each level
+ * 64 times of lower one, 2^32 ms in total
+ */
+#define MNET_TW_ROOT_BITS  8
+#define MNET_TW_LEVEL_BITS 6
+#define MNET_TW_LEVELS     4
+#define MNET_TW_ROOT_SIZE  (1 << MNET_TW_ROOT_BITS)
+#define MNET_TW_LEVEL_SIZE (1 << MNET_TW_LEVEL_BITS)
+#define MNET_TW_ROOT_MASK  (MNET_TW_ROOT_SIZE - 1)
+#define MNET_TW_LEVEL_MASK (MNET_TW_LEVEL_SIZE - 1)
+#define MNET_TW_SHIFT(l)   (MNET_TW_ROOT_BITS + (l) * MNET_TW_LEVEL_BITS)
+#define MNET_TW_MAX_MS     (2000 * 1000) /* max poll wait */
+
+typedef struct s_tnode {
+   struct s_tnode *prev;
+   struct s_tnode *next;
+} tnode_t;
+
+struct s_mtimer {
+   tnode_t node;                /* in wheel slot */
+   int64_t expire;              /* in ms */
+   int interval;                /* repeat interval, 0 for once */
+   int firing;                  /* in callback */
+   int canceled;
+   mnet_timer_cb cb;
+   void *ud;
+   struct s_mnet *ss;
+};
+
+typedef struct {
+   int64_t jiffies;             /* next tick to run, in ms */
+   int count;
+   tnode_t root[MNET_TW_ROOT_SIZE];
+   tnode_t level[MNET_TW_LEVELS][MNET_TW_LEVEL_SIZE];
+} mnet_wheel_t;
+
 typedef struct s_mnet {
    int init;
+   mnet_engine_t engine;
    int chann_count;
    chann_t *channs;
+   chann_t *closing;            /* channs to be destroyed after poll */
+   chann_t *fastopen;           /* channs to connect before poll */
+   chann_t *corked;             /* channs to flush when poll round ends */
+   int recv_budget;             /* bytes read in one poll, 0 unlimited */
+   int recv_quantum;            /* bytes read per chann in one poll */
+   int recv_used;
+   int rr_fd;                   /* fd to start with in next poll */
+   rwb_pool_t pool;             /* send buf pool */
+   mnet_wheel_t wheel;          /* timers */
    struct timeval tv;
    fd_set fdset[MNET_SET_MAX];
+#ifdef MNET_USE_EPOLL
+   int epfd;
+   struct epoll_event evs[MNET_EPOLL_MAX_EVENTS];
+   int evs_fd[MNET_EPOLL_MAX_EVENTS]; /* event fds before dispatch */
+#endif
+#ifdef MNET_USE_IOURING
+   mnet_uring_t ring;
+#endif
 } mnet_t;
 
-static mnet_t g_mnet;
+static mnet_t g_mnet;          /* default context */
 
 static inline mnet_t*
 _gmnet() {
@@ -126,24 +322,72 @@ _rwb_buffered(rwb_t *b) {
 
 static inline int
 _rwb_available(rwb_t *b) {
-   return b ? (MNET_BUF_SIZE - b->ptw) : 0;
+   return b ? (b->size - b->ptw) : 0;
 }
 
-static inline rwb_t*
-_rwb_new(void) {
-   rwb_t *b = (rwb_t*)mm_malloc(sizeof(rwb_t) + MNET_BUF_SIZE);
-   b->buf = (char*)b + sizeof(*b);
+/* get smallest size class for want bytes from pool */
+static rwb_t*
+_rwb_new(rwb_pool_t *pool, int want) {
+   rwb_t *b = NULL;
+   int cls = MNET_RWB_SMALL;
+   while (cls<MNET_RWB_LARGE && _rwb_class_size[cls]<want) {
+      cls++;
+   }
+   if ( pool->free[cls] ) {
+      b = pool->free[cls];
+      pool->free[cls] = b->next;
+      pool->count[cls]--;
+      b->ptr = b->ptw = 0;
+      b->next = NULL;
+   } else {
+      b = (rwb_t*)mm_malloc(sizeof(rwb_t) + _rwb_class_size[cls]);
+      b->buf = (char*)b + sizeof(*b);
+      b->size = _rwb_class_size[cls];
+      b->cls = cls;
+   }
    return b;
 }
 
+/* return to pool, free when over cap */
+static void
+_rwb_release(rwb_pool_t *pool, rwb_t *b) {
+   int cls = b->cls;
+   if (cls == MNET_RWB_OWNED) {
+      if ( b->release ) {
+         b->release(b->buf, b->ud);
+      }
+      mm_free(b);
+   }
+   else if (pool->count[cls] < (MNET_POOL_CAP_SIZE / b->size)) {
+      b->next = pool->free[cls];
+      pool->free[cls] = b;
+      pool->count[cls]++;
+   } else {
+      mm_free(b);
+   }
+}
+
+static void
+_rwb_pool_destroy(rwb_pool_t *pool) {
+   int cls = 0;
+   for (cls=0; cls<MNET_RWB_CLASS_MAX; cls++) {
+      while ( pool->free[cls] ) {
+         rwb_t *b = pool->free[cls];
+         pool->free[cls] = b->next;
+         mm_free(b);
+      }
+      pool->count[cls] = 0;
+   }
+}
+
 static rwb_t*
-_rwb_create_tail(rwb_head_t *h) {
+_rwb_create_tail(rwb_head_t *h, int want) {
    if (h->count <= 0) {
-      h->head = h->tail = _rwb_new();
+      h->head = h->tail = _rwb_new(h->pool, want);
       h->count++;
    }
    else if (_rwb_available(h->tail) <= 0) {
-      h->tail->next = _rwb_new();
+      h->tail->next = _rwb_new(h->pool, want);
       h->tail = h->tail->next;
       h->count++;
    }
@@ -155,7 +399,7 @@ _rwb_destroy_head(rwb_head_t *h) {
    if (_rwb_buffered(h->head) <= 0) {
       rwb_t *b = h->head;
       h->head = b->next;
-      mm_free(b);
+      _rwb_release(h->pool, b);
       if ((--h->count) <= 0) {
          h->head = h->tail = 0;
       }
@@ -165,8 +409,9 @@ _rwb_destroy_head(rwb_head_t *h) {
 static void
 _rwb_cache(rwb_head_t *h, char *buf, int buf_len) {
    int buf_ptw = 0;
+   h->bytes += buf_len;
    while (buf_ptw < buf_len) {
-      rwb_t *b = _rwb_create_tail(h);
+      rwb_t *b = _rwb_create_tail(h, buf_len - buf_ptw);
       int len = _MIN_OF(buf_len - buf_ptw, _rwb_available(b));
       memcpy(&b->buf[b->ptw], &buf[buf_ptw], len);
       b->ptw += len;
@@ -174,6 +419,29 @@ _rwb_cache(rwb_head_t *h, char *buf, int buf_len) {
    }
 }
 
+/* keep caller's buf in chain, offset already sent */
+static void
+_rwb_cache_owned(rwb_head_t *h, char *buf, int offset, int buf_len,
+                 chann_release_cb release, void *ud)
+{
+   rwb_t *b = (rwb_t*)mm_malloc(sizeof(rwb_t));
+   b->buf = buf;
+   b->ptr = offset;
+   b->ptw = b->size = buf_len; /* no available space */
+   b->cls = MNET_RWB_OWNED;
+   b->release = release;
+   b->ud = ud;
+   b->next = NULL;
+   if (h->count <= 0) {
+      h->head = h->tail = b;
+   } else {
+      h->tail->next = b;
+      h->tail = b;
+   }
+   h->count++;
+   h->bytes += buf_len - offset;
+}
+
 static char*
 _rwb_drain_param(rwb_head_t *h, int *len) {
    rwb_t *b = h->head;
@@ -182,8 +450,27 @@ _rwb_drain_param(rwb_head_t *h, int *len) {
    return &b->buf[b->ptr];
 }
 
+#ifndef _WIN32
+/* fill iovec from chain head, return iovec count */
+static int
+_rwb_drain_iov(rwb_head_t *h, struct iovec *iov, int iov_max) {
+   int i = 0;
+   rwb_t *b = h->head;
+   for (i=0; b && i<iov_max; b=b->next) {
+      int len = _rwb_buffered(b);
+      if (len > 0) {
+         iov[i].iov_base = &b->buf[b->ptr];
+         iov[i].iov_len = len;
+         i++;
+      }
+   }
+   return i;
+}
+#endif
+
 static void
 _rwb_drain(rwb_head_t *h, int drain_len) {
+   h->bytes -= _MIN_OF(drain_len, h->bytes);
    while ((h->count>0) && (drain_len>0)) {
       rwb_t *b = h->head;
       int len = _MIN_OF(drain_len, _rwb_buffered(b));
@@ -195,12 +482,13 @@ _rwb_drain(rwb_head_t *h, int drain_len) {
 
 static void
 _rwb_destroy(rwb_head_t *h) {
+   h->bytes = 0;
    while (h->count > 0) {
       rwb_t *b = h->head;
       if ( b ) {
          h->head = b->next;
          h->count--;
-         mm_free(b);
+         _rwb_release(h->pool, b);
       }
    }
 }
@@ -238,6 +526,21 @@ _set_reuseaddr(int fd) {
    return setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, (char*)&opt, sizeof(opt));
 }
 
+static int
+_set_intopt(int fd, int level, int name, int value) {
+   return setsockopt(fd, level, name, (char*)&value, sizeof(value));
+}
+
+static int
+_get_intopt(int fd, int level, int name) {
+   int value = 0;
+   socklen_t len = sizeof(value);
+   if (getsockopt(fd, level, name, (char*)&value, &len) < 0) {
+      return -1;
+   }
+   return value;
+}
+
 static int
 _set_bufsize(int fd) {
    int len = MNET_BUF_SIZE;
@@ -279,13 +582,272 @@ _select_zero(mnet_t *ss, int set) {
    FD_ZERO(&ss->fdset[set]);
 }
 
+/* epoll op, only register interest when chann state changes
+ */
+#ifdef MNET_USE_EPOLL
+static void
+_epoll_update(mnet_t *ss, chann_t *n) {
+   int mask = 0;
+   switch (n->state) {
+      case CHANN_STATE_LISTENING:
+         mask = n->active_recv_event ? EPOLLIN : 0;
+         break;
+      case CHANN_STATE_CONNECTING:
+         mask = EPOLLOUT;
+         break;
+      case CHANN_STATE_CONNECTED:
+         mask = n->active_recv_event ? EPOLLIN : 0;
+         if ((_rwb_count(&n->rwb_send)>0) || n->active_send_event) {
+            mask |= EPOLLOUT;
+         }
+         break;
+      default:
+         break;
+   }
+   if (mask != n->ev_mask) {
+      struct epoll_event ev;
+      int op = EPOLL_CTL_MOD;
+      if (n->ev_mask == 0) op = EPOLL_CTL_ADD;
+      else if (mask == 0) op = EPOLL_CTL_DEL;
+      ev.events = mask;
+      ev.data.ptr = n;
+      if (epoll_ctl(ss->epfd, op, n->fd, &ev) < 0) {
+         _err("chann %p fd %d epoll_ctl %d error %d\n", n, n->fd, op, errno);
+         return;
+      }
+      n->ev_mask = mask;
+   }
+}
+#endif
+
+/* io_uring op, readiness/accept/connect/send submitted in batch, one
+ * io_uring_enter() each poll round
+ */
+#ifdef MNET_USE_IOURING
+static int
+_uring_setup(unsigned entries, struct io_uring_params *p) {
+   return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int
+_uring_enter(int fd, unsigned to_submit, unsigned min_complete,
+             unsigned flags, void *arg, size_t argsz)
+{
+   return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete,
+                       flags, arg, argsz);
+}
+
+static int
+_uring_open(mnet_t *ss) {
+   mnet_uring_t *r = &ss->ring;
+   struct io_uring_params p;
+   char *ptr = NULL;
+
+   memset(&p, 0, sizeof(p));
+   r->fd = _uring_setup(MNET_URING_ENTRIES, &p);
+   if (r->fd < 0) {
+      return 0;
+   }
+   if (!(p.features & IORING_FEAT_SINGLE_MMAP) ||
+       !(p.features & IORING_FEAT_EXT_ARG))
+   {
+      goto fail;
+   }
+
+   r->ring_sz = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+   r->ring_sz = _MAX_OF(r->ring_sz, p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe));
+   r->ring_ptr = mmap(NULL, r->ring_sz, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+   if (r->ring_ptr == MAP_FAILED) {
+      goto fail;
+   }
+
+   r->sqes_sz = p.sq_entries * sizeof(struct io_uring_sqe);
+   r->sqes = (struct io_uring_sqe*)mmap(NULL, r->sqes_sz, PROT_READ | PROT_WRITE,
+                                        MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQES);
+   if (r->sqes == MAP_FAILED) {
+      munmap(r->ring_ptr, r->ring_sz);
+      goto fail;
+   }
+
+   ptr = (char*)r->ring_ptr;
+   r->sq_head = (unsigned*)(ptr + p.sq_off.head);
+   r->sq_tail = (unsigned*)(ptr + p.sq_off.tail);
+   r->sq_mask = (unsigned*)(ptr + p.sq_off.ring_mask);
+   r->sq_array = (unsigned*)(ptr + p.sq_off.array);
+   r->sq_entries = p.sq_entries;
+   r->cq_head = (unsigned*)(ptr + p.cq_off.head);
+   r->cq_tail = (unsigned*)(ptr + p.cq_off.tail);
+   r->cq_mask = (unsigned*)(ptr + p.cq_off.ring_mask);
+   r->cqes = (struct io_uring_cqe*)(ptr + p.cq_off.cqes);
+   return 1;
+
+  fail:
+   close(r->fd);
+   r->fd = -1;
+   return 0;
+}
+
+static void
+_uring_close(mnet_t *ss) {
+   mnet_uring_t *r = &ss->ring;
+   munmap(r->sqes, r->sqes_sz);
+   munmap(r->ring_ptr, r->ring_sz);
+   close(r->fd);                /* cancel all ops */
+   r->fd = -1;
+   while ( r->zombie ) {
+      chann_t *n = r->zombie;
+      r->zombie = n->close_next;
+      _rwb_destroy(&n->rwb_send);
+      mm_free(n);
+   }
+}
+
+static struct io_uring_sqe*
+_uring_get_sqe(mnet_t *ss) {
+   mnet_uring_t *r = &ss->ring;
+   unsigned tail = *r->sq_tail;
+   unsigned idx = 0;
+   struct io_uring_sqe *sqe = NULL;
+
+   if ((tail - __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE)) >= r->sq_entries) {
+      /* sq full, submit without wait */
+      _uring_enter(r->fd, r->to_submit, 0, 0, NULL, 0);
+      r->to_submit = 0;
+      if ((tail - __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE)) >= r->sq_entries) {
+         return NULL;
+      }
+   }
+   idx = tail & *r->sq_mask;
+   sqe = &r->sqes[idx];
+   memset(sqe, 0, sizeof(*sqe));
+   r->sq_array[idx] = idx;
+   __atomic_store_n(r->sq_tail, tail + 1, __ATOMIC_RELEASE);
+   r->to_submit++;
+   return sqe;
+}
+
+static int
+_uring_submit(mnet_t *ss, chann_t *n, int op, int opcode) {
+   struct io_uring_sqe *sqe = _uring_get_sqe(ss);
+   if (sqe == NULL) {
+      _err("chann %p fail to get sqe\n", n);
+      return 0;
+   }
+   sqe->opcode = opcode;
+   sqe->fd = n->fd;
+   sqe->user_data = (__u64)(uintptr_t)n | op;
+   switch (op) {
+      case MNET_URING_OP_POLL_IN:
+         sqe->poll32_events = POLLIN;
+         break;
+      case MNET_URING_OP_POLL_OUT:
+         sqe->poll32_events = POLLOUT;
+         break;
+      case MNET_URING_OP_SEND: {
+         struct msghdr *msg = &n->send_msg;
+         memset(msg, 0, sizeof(*msg));
+         msg->msg_iov = n->send_iov;
+         msg->msg_iovlen = _rwb_drain_iov(&n->rwb_send, n->send_iov, MNET_URING_IOV_MAX);
+         sqe->addr = (__u64)(uintptr_t)msg;
+         sqe->len = 1;
+         sqe->msg_flags = MSG_NOSIGNAL;
+         break;
+      }
+      case MNET_URING_OP_CONNECT:
+         sqe->addr = (__u64)(uintptr_t)&n->addr;
+         sqe->off = n->addr_len;
+         break;
+      case MNET_URING_OP_ACCEPT:
+         n->acc_len = sizeof(n->acc_addr);
+         sqe->addr = (__u64)(uintptr_t)&n->acc_addr;
+         sqe->addr2 = (__u64)(uintptr_t)&n->acc_len;
+         sqe->accept_flags = SOCK_NONBLOCK;
+         break;
+   }
+   n->uring_ops |= (1 << op);
+   return 1;
+}
+
+static void
+_uring_cancel(mnet_t *ss, chann_t *n) {
+   int op = 0;
+   for (op=MNET_URING_OP_POLL_IN; op<MNET_URING_OP_CANCEL; op++) {
+      if (n->uring_ops & (1 << op)) {
+         struct io_uring_sqe *sqe = _uring_get_sqe(ss);
+         if (sqe) {
+            sqe->opcode = IORING_OP_ASYNC_CANCEL;
+            sqe->fd = -1;
+            sqe->addr = (__u64)(uintptr_t)n | op;
+            sqe->user_data = MNET_URING_OP_CANCEL;
+         }
+      }
+   }
+}
+
+static void
+_chann_unlink_zombie(mnet_t *ss, chann_t *n) {
+   chann_t **pn = &ss->ring.zombie;
+   while ( *pn ) {
+      if (*pn == n) {
+         *pn = n->close_next;
+         break;
+      }
+      pn = &(*pn)->close_next;
+   }
+}
+
+static void
+_uring_dirty(mnet_t *ss, chann_t *n) {
+   if ( !n->uring_dirty ) {
+      n->uring_dirty = 1;
+      n->dirty_next = ss->ring.dirty;
+      ss->ring.dirty = n;
+   }
+}
+
+static void
+_uring_unlink_dirty(mnet_t *ss, chann_t *n) {
+   if ( n->uring_dirty ) {
+      chann_t **pn = &ss->ring.dirty;
+      while ( *pn ) {
+         if (*pn == n) {
+            *pn = n->dirty_next;
+            break;
+         }
+         pn = &(*pn)->dirty_next;
+      }
+      n->uring_dirty = 0;
+   }
+}
+#endif
+
+static inline void
+_event_update(mnet_t *ss, chann_t *n) {
+#ifdef MNET_USE_EPOLL
+   if (ss->engine == MNET_ENGINE_EPOLL) {
+      _epoll_update(ss, n);
+   }
+#endif
+#ifdef MNET_USE_IOURING
+   if (ss->engine == MNET_ENGINE_IOURING) {
+      _uring_dirty(ss, n);
+   }
+#endif
+}
+
 /* channel op
  */
 static chann_t*
 _chann_create(mnet_t *ss, chann_type_t type, chann_state_t state) {
    chann_t *n = (chann_t*)mm_malloc(sizeof(*n));
+   n->fd = -1;
+   n->ss = ss;
+   n->rwb_send.pool = &ss->pool;
    n->state = state;
    n->type = type;
+   n->active_recv_event = 1;
+   n->accept_budget = MNET_ACCEPT_BUDGET;
    n->next = ss->channs;
    if (ss->channs) {
       ss->channs->prev = n;
@@ -296,42 +858,135 @@ _chann_create(mnet_t *ss, chann_type_t type, chann_state_t state) {
    return n;
 }
 
+static void
+_chann_unlink_fastopen(mnet_t *ss, chann_t *n) {
+   chann_t **pn = &ss->fastopen;
+   while ( *pn ) {
+      if (*pn == n) {
+         *pn = n->tfo_next;
+         break;
+      }
+      pn = &(*pn)->tfo_next;
+   }
+   n->tfo_defer = 0;
+}
+
+static int _chann_flush(mnet_t *ss, chann_t *n);
+static void _chann_uncork(mnet_t *ss, chann_t *n);
+
+static void
+_chann_unlink_corked(mnet_t *ss, chann_t *n) {
+   chann_t **pn = &ss->corked;
+   while ( *pn ) {
+      if (*pn == n) {
+         *pn = n->cork_next;
+         break;
+      }
+      pn = &(*pn)->cork_next;
+   }
+   n->cork_queued = 0;
+}
+
 static void
 _chann_destroy(mnet_t *ss, chann_t *n) {
    if (n->next) n->next->prev = n->prev;
    if (n->prev) n->prev->next = n->next;
    else ss->channs = n->next;
-   _rwb_destroy(&n->rwb_send);
-   mm_free(n);
    ss->chann_count--;
    _log("chann destroy %p, count %d\n", n, ss->chann_count);
+   if (n->tune_timer) {
+      mnet_timer_cancel(n->tune_timer);
+      n->tune_timer = NULL;
+   }
+   if (n->tfo_defer) {
+      _chann_unlink_fastopen(ss, n);
+   }
+   if (n->cork_queued) {
+      _chann_unlink_corked(ss, n);
+   }
+#ifdef MNET_USE_IOURING
+   if (ss->engine == MNET_ENGINE_IOURING) {
+      _uring_unlink_dirty(ss, n);
+      if (n->uring_ops) {
+         /* keep memory and send buf until ops complete */
+         n->uring_zombie = 1;
+         n->close_next = ss->ring.zombie;
+         ss->ring.zombie = n;
+         return;
+      }
+   }
+#endif
+   _rwb_destroy(&n->rwb_send);
+   mm_free(n);
 }
 
 static chann_t*
 _chann_accept(mnet_t *ss, chann_t *n) {
    struct sockaddr_in addr;
    socklen_t addr_len = sizeof(addr);
+#ifdef __linux__
+   int fd = accept4(n->fd, (struct sockaddr*)&addr, &addr_len, SOCK_NONBLOCK);
+#else
    int fd = accept(n->fd, (struct sockaddr*)&addr, &addr_len);
-   if (fd > 0) {
-      if (_set_nonblocking(fd) >= 0) {
-         chann_t *c = _chann_create(ss, n->type, CHANN_STATE_CONNECTED);
-         c->fd = fd;
-         c->addr = addr;
-         c->addr_len = addr_len;
-         _log("chann %p accept %p fd %d, from %s, count %d\n", n, c, c->fd, mnet_chann_addr(c), ss->chann_count);
-         return c;
-      }
+   if (fd>=0 && _set_nonblocking(fd)<0) {
+      close(fd);
+      return NULL;
+   }
+#endif
+   if (fd >= 0) {
+      chann_t *c = _chann_create(ss, n->type, CHANN_STATE_CONNECTED);
+      c->fd = fd;
+      c->addr = addr;
+      c->addr_len = addr_len;
+      /* kernel copies listener socket options, keep them reported */
+      c->opt_mask = n->opt_mask & ~((1u << MNET_OPT_AUTOTUNE) | (1u << MNET_OPT_FASTOPEN));
+      memcpy(c->opt_val, n->opt_val, sizeof(c->opt_val));
+      _event_update(ss, c);
+      _log("chann %p accept %p fd %d, from %s, count %d\n", n, c, c->fd, mnet_chann_addr(c), ss->chann_count);
+      return c;
    }
    return NULL;
 }
 
+
 static void
 _chann_close(mnet_t *ss, chann_t *n) {
-   close(n->fd);
+#ifdef MNET_USE_IOURING
+   if (ss->engine==MNET_ENGINE_IOURING && n->uring_ops) {
+      _uring_cancel(ss, n);
+   }
+#endif
+   if (n->fd >= 0) {
+      close(n->fd);             /* also remove from epoll */
+      n->fd = -1;
+   }
+   n->ev_mask = 0;
    n->state = CHANN_STATE_CLOSED;
    /* _log("chann close fd %d\n", n->fd); */
 }
 
+/* mark closing, destroy after poll */
+static void
+_chann_set_closing(mnet_t *ss, chann_t *n) {
+   if (n->state != CHANN_STATE_CLOSING) {
+      n->state = CHANN_STATE_CLOSING;
+      n->close_next = ss->closing;
+      ss->closing = n;
+   }
+}
+
+static void
+_chann_unlink_closing(mnet_t *ss, chann_t *n) {
+   chann_t **pn = &ss->closing;
+   while ( *pn ) {
+      if (*pn == n) {
+         *pn = n->close_next;
+         break;
+      }
+      pn = &(*pn)->close_next;
+   }
+}
+
 static void
 _chann_event(chann_t *n, mnet_event_type_t event, chann_t *r) {
    chann_event_t e;
@@ -344,96 +999,661 @@ _chann_event(chann_t *n, mnet_event_type_t event, chann_t *r) {
    }
 }
 
-/* mnet api
- */
-int
-mnet_init() {
-   mnet_t *ss = _gmnet();
-   if ( !ss->init ) {
-#ifdef _WIN32
-      WSADATA wdata;
-      if (WSAStartup(MAKEWORD(2,2), &wdata) != 0) {
-         _err("fail to init !\n");
-         return 0;
+/* accept until queue empty or budget used, stop when listener closed or
+ * paused in callback */
+static void
+_chann_accept_burst(mnet_t *ss, chann_t *n, int budget) {
+   while (budget-- > 0 &&
+          n->state==CHANN_STATE_LISTENING && n->active_recv_event)
+   {
+      chann_t *c = _chann_accept(ss, n);
+      if (c == NULL) {
+         break;
       }
-#else
-      signal(SIGPIPE, SIG_IGN);
-#endif
-      memset(ss, 0, sizeof(mnet_t));
-      ss->init = 1;
-      _log("init\n");
-      return 1;
+      _chann_event(n, MNET_EVENT_ACCEPT, c);
    }
-   return 0;
 }
 
-void
-mnet_fini() {
-   mnet_t *ss = _gmnet();
-   if ( ss->init ) {
-      chann_t *n = ss->channs;
-      while ( n ) {
-         chann_t *next = n->next;
-         _chann_event(n, MNET_EVENT_CLOSE, NULL);
-         _chann_close(ss, n);
-         _chann_destroy(ss, n);
-         n = next;
-      }
-#ifdef _WIN32
-      WSACleanup();
-#endif
-      ss->init = 0;
-      _log("fini\n");
+/* event once when send queue cross watermark */
+static void
+_chann_check_mark(chann_t *n) {
+   int bytes = n->rwb_send.bytes;
+   if (n->wm_high <= 0) {
+      return;
+   }
+   if (!n->wm_over && bytes >= n->wm_high) {
+      n->wm_over = 1;
+      _chann_event(n, MNET_EVENT_SEND_HIGH, NULL);
+   }
+   else if (n->wm_over && bytes <= n->wm_low) {
+      n->wm_over = 0;
+      _chann_event(n, MNET_EVENT_SEND_LOW, NULL);
    }
 }
 
-int mnet_report(int level) {
-   mnet_t *ss = _gmnet();
-   if (ss->init) {
-      if (level > 0){
-         _log("-------- channs --------\n");
-         chann_t *n = ss->channs, *nn = NULL;
-         while (n) {
-            nn = n->next;
-            _log("chann %p, %s:%d\n", n, mnet_chann_addr(n), mnet_chann_port(n));
-            n = nn;
-         }
-         _log("------------------------\n");
-      }
-      return ss->chann_count;
-   }
-   return -1;
+/* timer wheel, O(1) add and cancel
+ */
+static inline int64_t
+_wheel_now(void) {
+   return mtime_monotonic() / 1000;
 }
 
-chann_t*
-mnet_chann_open(chann_type_t type) {
-   return _chann_create(_gmnet(), type, CHANN_STATE_CLOSED);
+static inline void
+_tnode_init(tnode_t *h) {
+   h->prev = h->next = h;
 }
 
-void mnet_chann_close(chann_t *n) {
-   if ( n ) {
-      if (n->state == CHANN_STATE_CLOSING) {
-         _chann_close(_gmnet(), n);
-         _chann_destroy(_gmnet(), n);
-      } else {
-         n->state = CHANN_STATE_CLOSING;
-      }
-   }
+static inline int
+_tnode_empty(tnode_t *h) {
+   return h->next == h;
 }
 
-int mnet_chann_state(chann_t *n) {
-   return n ? n->state : CHANN_STATE_CLOSED;
+static inline void
+_tnode_add(tnode_t *h, tnode_t *n) {
+   n->prev = h->prev;
+   n->next = h;
+   h->prev->next = n;
+   h->prev = n;
 }
 
-static void
-_chann_fill_addr(chann_t *n, const char *host, int port) {
-   n->addr.sin_family = AF_INET;
-   n->addr.sin_port = htons(port);
+static inline void
+_tnode_del(tnode_t *n) {
+   n->prev->next = n->next;
+   n->next->prev = n->prev;
+   _tnode_init(n);
+}
+
+/* move all nodes in from to empty to */
+static inline void
+_tnode_splice(tnode_t *from, tnode_t *to) {
+   _tnode_init(to);
+   if ( !_tnode_empty(from) ) {
+      to->next = from->next;
+      to->prev = from->prev;
+      to->next->prev = to;
+      to->prev->next = to;
+      _tnode_init(from);
+   }
+}
+
+static void
+_wheel_init(mnet_wheel_t *w) {
+   int i = 0, l = 0;
+   for (i=0; i<MNET_TW_ROOT_SIZE; i++) {
+      _tnode_init(&w->root[i]);
+   }
+   for (l=0; l<MNET_TW_LEVELS; l++) {
+      for (i=0; i<MNET_TW_LEVEL_SIZE; i++) {
+         _tnode_init(&w->level[l][i]);
+      }
+   }
+   w->jiffies = _wheel_now();
+   w->count = 0;
+}
+
+static void
+_wheel_add(mnet_wheel_t *w, struct s_mtimer *t) {
+   int64_t expire = 0, idx = 0;
+   tnode_t *h = NULL;
+
+   if (t->expire < w->jiffies) {
+      t->expire = w->jiffies;
+   }
+   expire = t->expire;
+   idx = expire - w->jiffies;
+
+   if (idx < MNET_TW_ROOT_SIZE) {
+      h = &w->root[expire & MNET_TW_ROOT_MASK];
+   }
+   else {
+      int l = 0;
+      while ((l < MNET_TW_LEVELS-1) && (idx >= ((int64_t)1 << MNET_TW_SHIFT(l+1)))) {
+         l++;
+      }
+      if (idx >= ((int64_t)1 << MNET_TW_SHIFT(MNET_TW_LEVELS))) {
+         /* over range, re-cascade until in range */
+         expire = w->jiffies + ((int64_t)1 << MNET_TW_SHIFT(MNET_TW_LEVELS)) - 1;
+      }
+      h = &w->level[l][(expire >> MNET_TW_SHIFT(l)) & MNET_TW_LEVEL_MASK];
+   }
+   _tnode_add(h, &t->node);
+}
+
+static int
+_wheel_cascade(mnet_wheel_t *w, int l) {
+   int index = (int)((w->jiffies >> MNET_TW_SHIFT(l)) & MNET_TW_LEVEL_MASK);
+   tnode_t list;
+   _tnode_splice(&w->level[l][index], &list);
+   while ( !_tnode_empty(&list) ) {
+      tnode_t *n = list.next;
+      _tnode_del(n);
+      _wheel_add(w, (struct s_mtimer*)n);
+   }
+   return index;
+}
+
+static void
+_wheel_run(mnet_wheel_t *w) {
+   int64_t now = _wheel_now();
+
+   while ((w->count > 0) && (w->jiffies <= now)) {
+      int index = (int)(w->jiffies & MNET_TW_ROOT_MASK);
+      tnode_t list;
+
+      if (index == 0) {
+         int l = 0;
+         while ((l < MNET_TW_LEVELS) && (_wheel_cascade(w, l) == 0)) {
+            l++;
+         }
+      }
+
+      _tnode_splice(&w->root[index], &list);
+      w->jiffies++;
+
+      while ( !_tnode_empty(&list) ) {
+         struct s_mtimer *t = (struct s_mtimer*)list.next;
+         _tnode_del(&t->node);
+
+         t->firing = 1;
+         t->cb(t, t->ud);
+         t->firing = 0;
+
+         if ( t->canceled ) {
+            w->count--;
+            mm_free(t);
+         }
+         else if ( !_tnode_empty(&t->node) ) {
+            /* reset in callback */
+         }
+         else if (t->interval > 0) {
+            t->expire += t->interval;
+            _wheel_add(w, t);
+         }
+         else {
+            w->count--;
+            mm_free(t);
+         }
+      }
+   }
+
+   if (w->count <= 0) {
+      w->jiffies = now;         /* skip idle ticks */
+   }
+}
+
+/* ms to next expiry or cascade, -1 for no timer */
+static int
+_wheel_next(mnet_wheel_t *w) {
+   int64_t next = w->jiffies + MNET_TW_MAX_MS;
+   int64_t now = _wheel_now();
+   int i = 0, l = 0;
+
+   if (w->count <= 0) {
+      return -1;
+   }
+
+   for (i=0; i<MNET_TW_ROOT_SIZE; i++) {
+      if ( !_tnode_empty(&w->root[(w->jiffies + i) & MNET_TW_ROOT_MASK]) ) {
+         next = w->jiffies + i;
+         break;
+      }
+   }
+
+   for (l=0; l<MNET_TW_LEVELS; l++) {
+      int shift = MNET_TW_SHIFT(l);
+      int64_t base = w->jiffies >> shift;
+      /* slot of base cascaded when jiffies aligned */
+      i = (w->jiffies & (((int64_t)1 << shift) - 1)) ? 1 : 0;
+      for (; i<=MNET_TW_LEVEL_SIZE; i++) {
+         if ( !_tnode_empty(&w->level[l][(base + i) & MNET_TW_LEVEL_MASK]) ) {
+            next = _MIN_OF(next, (base + i) << shift);
+            break;
+         }
+      }
+   }
+
+   next -= now;
+   return (int)(next < 0 ? 0 : _MIN_OF(next, MNET_TW_MAX_MS));
+}
+
+static void
+_wheel_destroy(mnet_wheel_t *w) {
+   int i = 0, l = 0;
+   for (i=0; i<MNET_TW_ROOT_SIZE; i++) {
+      while ( !_tnode_empty(&w->root[i]) ) {
+         tnode_t *n = w->root[i].next;
+         _tnode_del(n);
+         mm_free(n);
+      }
+   }
+   for (l=0; l<MNET_TW_LEVELS; l++) {
+      for (i=0; i<MNET_TW_LEVEL_SIZE; i++) {
+         while ( !_tnode_empty(&w->level[l][i]) ) {
+            tnode_t *n = w->level[l][i].next;
+            _tnode_del(n);
+            mm_free(n);
+         }
+      }
+   }
+   w->count = 0;
+}
+
+/* mnet api
+ */
+static mnet_engine_t
+_engine_open(mnet_t *ss, mnet_engine_t engine) {
+#ifdef MNET_USE_IOURING
+   if (engine == MNET_ENGINE_IOURING) {
+      if (_uring_open(ss) > 0) {
+         return MNET_ENGINE_IOURING;
+      }
+      _err("fail to setup io_uring, fallback\n");
+   }
+#endif
+#ifdef MNET_USE_EPOLL
+   if (engine != MNET_ENGINE_SELECT) {
+      ss->epfd = epoll_create1(0);
+      if (ss->epfd >= 0) {
+         return MNET_ENGINE_EPOLL;
+      }
+      _err("fail to create epoll, fallback to select\n");
+   }
+#endif
+   return MNET_ENGINE_SELECT;
+}
+
+static void
+_engine_close(mnet_t *ss) {
+#ifdef MNET_USE_EPOLL
+   if (ss->engine == MNET_ENGINE_EPOLL) {
+      close(ss->epfd);
+   }
+#endif
+#ifdef MNET_USE_IOURING
+   if (ss->engine == MNET_ENGINE_IOURING) {
+      _uring_close(ss);
+   }
+#endif
+}
+
+static int
+_ctx_init(mnet_t *ss, mnet_engine_t engine) {
+#ifdef _WIN32
+   WSADATA wdata;
+   if (WSAStartup(MAKEWORD(2,2), &wdata) != 0) {
+      _err("fail to init !\n");
+      return 0;
+   }
+#else
+   signal(SIGPIPE, SIG_IGN);
+#endif
+   memset(ss, 0, sizeof(mnet_t));
+   _wheel_init(&ss->wheel);
+   ss->recv_quantum = MNET_RECV_QUANTUM;
+   ss->engine = _engine_open(ss, engine);
+   ss->init = 1;
+   _log("init %p engine %d\n", ss, ss->engine);
+   return 1;
+}
+
+static void
+_ctx_fini(mnet_t *ss) {
+   if ( ss->init ) {
+      chann_t *n = ss->channs;
+      while ( n ) {
+         chann_t *next = n->next;
+         _chann_event(n, MNET_EVENT_CLOSE, NULL);
+         _chann_close(ss, n);
+         _chann_destroy(ss, n);
+         n = next;
+      }
+      ss->closing = NULL;
+      _engine_close(ss);
+      _wheel_destroy(&ss->wheel);
+      _rwb_pool_destroy(&ss->pool);
+#ifdef _WIN32
+      WSACleanup();
+#endif
+      ss->init = 0;
+      _log("fini %p\n", ss);
+   }
+}
+
+int
+mnet_init() {
+   return mnet_init_ex(MNET_ENGINE_DEFAULT);
+}
+
+int
+mnet_init_ex(mnet_engine_t engine) {
+   mnet_t *ss = _gmnet();
+   if ( !ss->init ) {
+      return _ctx_init(ss, engine);
+   }
+   return 0;
+}
+
+void
+mnet_fini() {
+   _ctx_fini(_gmnet());
+}
+
+mnet_engine_t
+mnet_engine(void) {
+   return mnet_ctx_engine(_gmnet());
+}
+
+void
+mnet_set_recv_budget(int budget, int quantum) {
+   mnet_ctx_set_recv_budget(_gmnet(), budget, quantum);
+}
+
+int mnet_report(int level) {
+   return mnet_ctx_report(_gmnet(), level);
+}
+
+mnet_ctx_t*
+mnet_ctx_default(void) {
+   return _gmnet();
+}
+
+mnet_ctx_t*
+mnet_ctx_create(mnet_engine_t engine) {
+   mnet_t *ss = (mnet_t*)mm_malloc(sizeof(mnet_t));
+   if (_ctx_init(ss, engine) > 0) {
+      return ss;
+   }
+   mm_free(ss);
+   return NULL;
+}
+
+void
+mnet_ctx_destroy(mnet_ctx_t *ctx) {
+   if (ctx && ctx != _gmnet()) {
+      _ctx_fini(ctx);
+      mm_free(ctx);
+   }
+}
+
+void
+mnet_ctx_set_recv_budget(mnet_ctx_t *ctx, int budget, int quantum) {
+   if (ctx && ctx->init) {
+      ctx->recv_budget = _MAX_OF(budget, 0);
+      ctx->recv_quantum = quantum>0 ? quantum : MNET_RECV_QUANTUM;
+   }
+}
+
+mnet_engine_t
+mnet_ctx_engine(mnet_ctx_t *ctx) {
+   return (ctx && ctx->init) ? ctx->engine : MNET_ENGINE_DEFAULT;
+}
+
+int mnet_ctx_report(mnet_ctx_t *ctx, int level) {
+   mnet_t *ss = ctx;
+   if (ss && ss->init) {
+      if (level > 0){
+         _log("-------- channs --------\n");
+         chann_t *n = ss->channs, *nn = NULL;
+         while (n) {
+            nn = n->next;
+            _log("chann %p, %s:%d\n", n, mnet_chann_addr(n), mnet_chann_port(n));
+            n = nn;
+         }
+         _log("------------------------\n");
+      }
+      return ss->chann_count;
+   }
+   return -1;
+}
+
+chann_t*
+mnet_chann_open(chann_type_t type) {
+   return mnet_ctx_chann_open(_gmnet(), type);
+}
+
+chann_t*
+mnet_ctx_chann_open(mnet_ctx_t *ctx, chann_type_t type) {
+   if (ctx && ctx->init) {
+      return _chann_create(ctx, type, CHANN_STATE_CLOSED);
+   }
+   return NULL;
+}
+
+mnet_ctx_t*
+mnet_chann_ctx(chann_t *n) {
+   return n ? n->ss : NULL;
+}
+
+void mnet_chann_close(chann_t *n) {
+   if ( n ) {
+      mnet_t *ss = n->ss;
+      if ( n->cork_queued ) {
+         _chann_uncork(ss, n);
+      }
+      if (n->state == CHANN_STATE_CLOSING) {
+         _chann_unlink_closing(ss, n);
+         _chann_close(ss, n);
+         _chann_destroy(ss, n);
+      } else {
+         _chann_set_closing(ss, n);
+      }
+   }
+}
+
+int mnet_chann_state(chann_t *n) {
+   return n ? n->state : CHANN_STATE_CLOSED;
+}
+
+static void
+_chann_fill_addr(chann_t *n, const char *host, int port) {
+   n->addr.sin_family = AF_INET;
+   n->addr.sin_port = htons(port);
    n->addr.sin_addr.s_addr = 
       host==NULL ? htonl(INADDR_ANY) : inet_addr(host);
    n->addr_len = sizeof(n->addr);
 }
 
+/* socket options
+ */
+static int
+_chann_set_sockopt(int fd, mnet_opt_t opt, int value) {
+   switch ( opt ) {
+      case MNET_OPT_SNDBUF:
+         return _set_intopt(fd, SOL_SOCKET, SO_SNDBUF, value);
+      case MNET_OPT_RCVBUF:
+         return _set_intopt(fd, SOL_SOCKET, SO_RCVBUF, value);
+      case MNET_OPT_NODELAY:
+         return _set_intopt(fd, IPPROTO_TCP, TCP_NODELAY, value ? 1 : 0);
+      case MNET_OPT_NOTSENT_LOWAT:
+#ifdef TCP_NOTSENT_LOWAT
+         return _set_intopt(fd, IPPROTO_TCP, TCP_NOTSENT_LOWAT, value);
+#else
+         return 0;
+#endif
+      case MNET_OPT_KEEPALIVE:
+         if (_set_intopt(fd, SOL_SOCKET, SO_KEEPALIVE, value>0 ? 1 : 0) < 0) {
+            return -1;
+         }
+#ifdef TCP_KEEPIDLE
+         if (value > 0) return _set_intopt(fd, IPPROTO_TCP, TCP_KEEPIDLE, value);
+#endif
+         return 0;
+      case MNET_OPT_FASTOPEN:
+#ifdef TCP_FASTOPEN
+         /* queue length for listener, client uses MSG_FASTOPEN */
+         return _set_intopt(fd, IPPROTO_TCP, TCP_FASTOPEN, value);
+#else
+         return 0;
+#endif
+      case MNET_OPT_KEEPINTVL:
+#ifdef TCP_KEEPINTVL
+         return _set_intopt(fd, IPPROTO_TCP, TCP_KEEPINTVL, value);
+#else
+         return 0;
+#endif
+      case MNET_OPT_KEEPCNT:
+#ifdef TCP_KEEPCNT
+         return _set_intopt(fd, IPPROTO_TCP, TCP_KEEPCNT, value);
+#else
+         return 0;
+#endif
+      case MNET_OPT_LINGER: {
+         struct linger lg;
+         lg.l_onoff = 1;
+         lg.l_linger = value>0 ? value : 0;
+         return setsockopt(fd, SOL_SOCKET, SO_LINGER, (char*)&lg, sizeof(lg));
+      }
+      default:
+         return 0;
+   }
+}
+
+static int
+_chann_get_sockopt(int fd, mnet_opt_t opt) {
+   switch ( opt ) {
+      case MNET_OPT_SNDBUF:
+         return _get_intopt(fd, SOL_SOCKET, SO_SNDBUF);
+      case MNET_OPT_RCVBUF:
+         return _get_intopt(fd, SOL_SOCKET, SO_RCVBUF);
+      case MNET_OPT_NODELAY:
+         return _get_intopt(fd, IPPROTO_TCP, TCP_NODELAY);
+#ifdef TCP_NOTSENT_LOWAT
+      case MNET_OPT_NOTSENT_LOWAT:
+         return _get_intopt(fd, IPPROTO_TCP, TCP_NOTSENT_LOWAT);
+#endif
+#ifdef TCP_KEEPIDLE
+      case MNET_OPT_KEEPALIVE: {
+         int on = _get_intopt(fd, SOL_SOCKET, SO_KEEPALIVE);
+         return on>0 ? _get_intopt(fd, IPPROTO_TCP, TCP_KEEPIDLE) : on;
+      }
+#endif
+#ifdef TCP_FASTOPEN
+      case MNET_OPT_FASTOPEN:
+         return _get_intopt(fd, IPPROTO_TCP, TCP_FASTOPEN);
+#endif
+#ifdef TCP_KEEPINTVL
+      case MNET_OPT_KEEPINTVL:
+         return _get_intopt(fd, IPPROTO_TCP, TCP_KEEPINTVL);
+#endif
+#ifdef TCP_KEEPCNT
+      case MNET_OPT_KEEPCNT:
+         return _get_intopt(fd, IPPROTO_TCP, TCP_KEEPCNT);
+#endif
+      case MNET_OPT_LINGER: {
+         struct linger lg;
+         socklen_t len = sizeof(lg);
+         if (getsockopt(fd, SOL_SOCKET, SO_LINGER, (char*)&lg, &len) < 0) {
+            return -1;
+         }
+         return lg.l_onoff ? lg.l_linger : -1;
+      }
+      default:
+         return -1;
+   }
+}
+
+/* options set before socket opened, fast open queue only for listener */
+static int
+_chann_apply_opts(chann_t *n, int fd, int listen) {
+   int i;
+   for (i=0; i<MNET_OPT_AUTOTUNE; i++) {
+      if ((n->opt_mask & (1u << i)) &&
+          (n->type==CHANN_TYPE_STREAM || i<=MNET_OPT_RCVBUF) &&
+          (i!=MNET_OPT_FASTOPEN || listen) &&
+          _chann_set_sockopt(fd, (mnet_opt_t)i, n->opt_val[i]) < 0)
+      {
+         return -1;
+      }
+   }
+   return 0;
+}
+
+#ifdef __linux__
+/* nth number in sysctl file, def when unreadable */
+static int
+_chann_sysctl(const char *path, int nth, int def) {
+   int value = 0, ret = def;
+   FILE *fp = fopen(path, "r");
+   if ( fp ) {
+      for (int i=0; i<=nth && fscanf(fp, "%d", &value)==1; i++) {
+         if (i == nth && value > 0) {
+            ret = value;
+         }
+      }
+      fclose(fp);
+   }
+   return ret;
+}
+
+/* set size capped by net.core.wmem_max/rmem_max, kernel autotunes up to
+   tcp_wmem/tcp_rmem max when never set */
+static void
+_chann_buf_limits(mnet_opt_t opt, int *set_max, int *auto_max) {
+   static int lim[2][2] = { {0, 0}, {0, 0} };
+   int i = (opt == MNET_OPT_SNDBUF) ? 0 : 1;
+   if (lim[i][0] == 0) {
+      lim[i][0] = _chann_sysctl(i==0 ? "/proc/sys/net/core/wmem_max" : "/proc/sys/net/core/rmem_max",
+                                0, 212992);
+      lim[i][1] = _chann_sysctl(i==0 ? "/proc/sys/net/ipv4/tcp_wmem" : "/proc/sys/net/ipv4/tcp_rmem",
+                                2, i==0 ? 4194304 : 6291456);
+   }
+   *set_max = lim[i][0];
+   *auto_max = lim[i][1];
+}
+#endif
+
+/* grow buffer to want bytes, setting locks out kernel autotuning, so only
+   set when the size the kernel takes passes both its autotune ceiling and
+   what it already chose */
+static void
+_chann_tune_buf(chann_t *n, mnet_opt_t opt, int64_t want) {
+   int cur = _chann_get_sockopt(n->fd, opt);
+   want = _MIN_OF(want, n->opt_val[MNET_OPT_AUTOTUNE]);
+#ifdef __linux__
+   int set_max = 0, auto_max = 0;
+   _chann_buf_limits(opt, &set_max, &auto_max);
+   cur /= 2;                    /* kernel doubles for bookkeeping */
+   want = _MIN_OF(want, set_max);
+   if (2 * want <= auto_max) {
+      return;
+   }
+#endif
+   if (cur<=0 || want <= cur + cur/4) {
+      return;
+   }
+   _chann_set_sockopt(n->fd, opt, (int)want);
+   _log("chann %p tune %s %d -> %d\n", n,
+        opt==MNET_OPT_SNDBUF ? "sndbuf" : "rcvbuf", cur, (int)want);
+}
+
+/* size buffers to twice the bandwidth-delay product, bandwidth from bytes
+   moved since last tune and congestion window, rtt from TCP_INFO */
+static void
+_chann_tune_cb(mnet_timer_t *t, void *ud) {
+   chann_t *n = (chann_t*)ud;
+   int64_t now = mtime_monotonic();
+   int64_t dt = now - n->tune_ti;
+   int64_t sent = n->bytes_send - n->tune_send;
+   int64_t recv = n->bytes_recv - n->tune_recv;
+   n->tune_ti = now;
+   n->tune_send = n->bytes_send;
+   n->tune_recv = n->bytes_recv;
+#if defined(TCP_INFO) && !defined(_WIN32)
+   if (n->state==CHANN_STATE_CONNECTED && n->type==CHANN_TYPE_STREAM && dt>0) {
+      struct tcp_info ti;
+      socklen_t len = sizeof(ti);
+      if (getsockopt(n->fd, IPPROTO_TCP, TCP_INFO, &ti, &len)==0 && ti.tcpi_rtt>0) {
+         int64_t rcv_rtt = ti.tcpi_rcv_rtt>0 ? ti.tcpi_rcv_rtt : ti.tcpi_rtt;
+         int64_t bdp_send = _MAX_OF(sent * ti.tcpi_rtt / dt,
+                                    (int64_t)ti.tcpi_snd_cwnd * ti.tcpi_snd_mss);
+         int64_t bdp_recv = _MAX_OF(recv * rcv_rtt / dt, (int64_t)ti.tcpi_rcv_space);
+         _chann_tune_buf(n, MNET_OPT_SNDBUF, 2 * bdp_send);
+         _chann_tune_buf(n, MNET_OPT_RCVBUF, 2 * bdp_recv);
+      }
+   }
+#endif
+}
+
 static int
 _chann_open_socket(chann_t *n, const char *host, int port, int backlog) {
    if (n->state == CHANN_STATE_CLOSED) {
@@ -449,7 +1669,8 @@ _chann_open_socket(chann_t *n, const char *host, int port, int backlog) {
          if (_set_nonblocking(fd) < 0) goto fail;
          if (istcp && _set_keepalive(fd)<0) goto fail;
          if (isbc && _set_broadcast(fd)<0) goto fail;
-         if (_set_bufsize(fd) < 0) goto fail;
+         if (!istcp && _set_bufsize(fd)<0) goto fail;
+         if (_chann_apply_opts(n, fd, backlog && istcp) < 0) goto fail;
          return fd;
 
         fail:
@@ -463,12 +1684,88 @@ _chann_open_socket(chann_t *n, const char *host, int port, int backlog) {
    return -1;
 }
 
+#ifdef MSG_FASTOPEN
+static int
+_chann_use_fastopen(chann_t *n) {
+   return (n->opt_mask & (1u << MNET_OPT_FASTOPEN)) &&
+      n->opt_val[MNET_OPT_FASTOPEN] > 0 &&
+      n->ss->engine != MNET_ENGINE_IOURING;
+}
+
+/* send cached data in SYN, or plain connect when nothing cached or
+ * fast open not available */
+static void
+_chann_connect_fastopen(mnet_t *ss, chann_t *n) {
+   rwb_head_t *prh = &n->rwb_send;
+   int ret = -1, started = 0;
+
+   if (_rwb_count(prh) > 0) {
+      struct iovec iov[IOV_MAX];
+      struct msghdr msg;
+      memset(&msg, 0, sizeof(msg));
+      msg.msg_name = &n->addr;
+      msg.msg_namelen = n->addr_len;
+      msg.msg_iov = iov;
+      msg.msg_iovlen = _rwb_drain_iov(prh, iov, IOV_MAX);
+      ret = (int)sendmsg(n->fd, &msg, MSG_FASTOPEN | MSG_NOSIGNAL);
+      if (ret >= 0) {
+         n->bytes_send += ret;
+         _rwb_drain(prh, ret);
+         _chann_check_mark(n);
+         _log("chann %p fd:%d fast open %d bytes in SYN\n", n, n->fd, ret);
+      }
+      /* EINPROGRESS when no cookie yet, SYN sent with cookie request */
+      started = (ret>=0 || errno==EINPROGRESS);
+   }
+
+   if ( !started ) {
+      ret = connect(n->fd, (struct sockaddr*)&n->addr, n->addr_len);
+      if (ret<0 && errno!=EINPROGRESS && errno!=EWOULDBLOCK) {
+         _chann_set_closing(ss, n);
+         _chann_event(n, MNET_EVENT_DISCONNECT, NULL);
+         return;
+      }
+   }
+   _event_update(ss, n);
+}
+
+static void
+_chann_process_fastopen(mnet_t *ss) {
+   while ( ss->fastopen ) {
+      chann_t *n = ss->fastopen;
+      ss->fastopen = n->tfo_next;
+      n->tfo_next = NULL;
+      n->tfo_defer = 0;
+      if (n->state == CHANN_STATE_CONNECTING) {
+         _chann_connect_fastopen(ss, n);
+      }
+   }
+}
+#endif
+
 int
 mnet_chann_connect(chann_t *n, const char *host, int port) {
    if (n && host && port>0) {
       int fd = _chann_open_socket(n, host, port, 0);
       if (fd > 0) {
          n->fd = fd;
+#ifdef MNET_USE_IOURING
+         if (n->ss->engine==MNET_ENGINE_IOURING && n->type==CHANN_TYPE_STREAM) {
+            /* submit connect op in poll */
+            n->state = CHANN_STATE_CONNECTING;
+         } else
+#endif
+#ifdef MSG_FASTOPEN
+         if (n->type==CHANN_TYPE_STREAM && _chann_use_fastopen(n)) {
+            /* connect before next poll, data sent till then in SYN */
+            n->state = CHANN_STATE_CONNECTING;
+            n->tfo_defer = 1;
+            n->tfo_next = n->ss->fastopen;
+            n->ss->fastopen = n;
+            _log("chann %p fd:%d fast open deferred\n", n, fd);
+            return 1;
+         } else
+#endif
          if (n->type == CHANN_TYPE_STREAM) {
             int r = connect(fd, (struct sockaddr*)&n->addr, n->addr_len);
             if (r < 0) {
@@ -480,6 +1777,7 @@ mnet_chann_connect(chann_t *n, const char *host, int port) {
             n->state = CHANN_STATE_CONNECTED;
             _log("chann %p fd:%d type:%d connected\n", n, fd, n->type);
          }
+         _event_update(n->ss, n);
          return 1;
       }
       _err("chann %p fail to connect\n", n);
@@ -495,6 +1793,7 @@ mnet_chann_listen_ex(
       if (fd > 0) {
          n->fd = fd;
          n->state = CHANN_STATE_LISTENING;
+         _event_update(n->ss, n);
          _log("chann %p, fd:%d listen\n", n, fd);
          return 1;
       }
@@ -516,10 +1815,69 @@ void mnet_chann_active_event(chann_t *n, mnet_event_type_t et, int active) {
    if ( n ) {
       if (et == MNET_EVENT_SEND) {
          n->active_send_event = active;
+         _event_update(n->ss, n);
+      }
+      else if (et == MNET_EVENT_RECV) {
+         n->active_recv_event = active;
+         _event_update(n->ss, n);
       }
    }
 }
 
+int mnet_chann_setopt(chann_t *n, mnet_opt_t opt, int value) {
+   if (n==NULL || opt<0 || opt>=MNET_OPT_MAX) {
+      return -1;
+   }
+   n->opt_val[opt] = value;
+   n->opt_mask |= (1u << opt);
+   if (opt == MNET_OPT_AUTOTUNE) {
+#if defined(TCP_INFO) && !defined(_WIN32)
+      if (value>0 && n->tune_timer==NULL) {
+         n->tune_ti = mtime_monotonic();
+         n->tune_send = n->bytes_send;
+         n->tune_recv = n->bytes_recv;
+         n->tune_timer = mnet_ctx_timer_add(n->ss, MNET_TUNE_INTERVAL,
+                                            MNET_TUNE_INTERVAL, _chann_tune_cb, n);
+      }
+      else if (value<=0 && n->tune_timer) {
+         mnet_timer_cancel(n->tune_timer);
+         n->tune_timer = NULL;
+      }
+      return 0;
+#else
+      return -1;                /* no TCP_INFO */
+#endif
+   }
+   if (n->fd>=0 && (opt!=MNET_OPT_FASTOPEN || n->state==CHANN_STATE_LISTENING)) {
+      return _chann_set_sockopt(n->fd, opt, value);
+   }
+   return 0;
+}
+
+int mnet_chann_getopt(chann_t *n, mnet_opt_t opt) {
+   if (n==NULL || opt<0 || opt>=MNET_OPT_MAX) {
+      return -1;
+   }
+   if (opt==MNET_OPT_AUTOTUNE || n->fd<0) {
+      return (n->opt_mask & (1u << opt)) ? n->opt_val[opt] : -1;
+   }
+   return _chann_get_sockopt(n->fd, opt);
+}
+
+void mnet_chann_set_accept_budget(chann_t *n, int budget) {
+   if ( n ) {
+      n->accept_budget = budget>0 ? budget : MNET_ACCEPT_BUDGET;
+   }
+}
+
+void mnet_chann_set_watermark(chann_t *n, int low, int high) {
+   if ( n ) {
+      n->wm_low = _MIN_OF(low, high);
+      n->wm_high = high;
+      _chann_check_mark(n);
+   }
+}
+
 int mnet_chann_recv(chann_t *n, void *buf, int len) {
    if (n && buf && len>0) {
       int ret = 0;
@@ -529,12 +1887,108 @@ int mnet_chann_recv(chann_t *n, void *buf, int len) {
          n->addr_len = sizeof(n->addr);
          ret = (int)recvfrom(n->fd, buf, len, 0, (struct sockaddr*)&(n->addr), &(n->addr_len));
       }
-      if (ret <= 0) {
-         if (errno != EWOULDBLOCK) {
-            n->state = CHANN_STATE_CLOSING;
+      if (ret <= 0) {
+         if ((ret==0 && n->type==CHANN_TYPE_STREAM) ||
+             (ret<0 && errno!=EWOULDBLOCK))
+         {
+            _chann_set_closing(n->ss, n);
+         }
+      } else {
+         n->bytes_recv += ret;
+      }
+      n->recv_drained = (ret < len);
+      return ret;
+   }
+   assert(n);
+   return -1;
+}
+
+/* stream not connected yet, cache data till connected */
+static inline int
+_chann_connecting(chann_t *n) {
+   return n->type==CHANN_TYPE_STREAM && n->state==CHANN_STATE_CONNECTING;
+}
+
+/* corked stream caches data in poll round, io_uring already submits sends
+   once per poll; not while waiting writable */
+static inline int
+_chann_corking(chann_t *n) {
+   return n->cork_size>0 && n->type==CHANN_TYPE_STREAM &&
+      n->state==CHANN_STATE_CONNECTED && n->ss->engine!=MNET_ENGINE_IOURING &&
+      (n->cork_queued || _rwb_count(&n->rwb_send)<=0);
+}
+
+/* flush at threshold, or queue to the end of poll round */
+static void
+_chann_cork_check(chann_t *n) {
+   mnet_t *ss = n->ss;
+   if (n->rwb_send.bytes >= n->cork_size) {
+      _chann_uncork(ss, n);
+   }
+   else {
+      if ( !n->cork_queued ) {
+         n->cork_queued = 1;
+         n->cork_next = ss->corked;
+         ss->corked = n;
+      }
+      _chann_check_mark(n);
+   }
+}
+
+static int
+_chann_send(chann_t *n, void *buf, int len) {
+   int ret = 0;
+   if (n->type == CHANN_TYPE_STREAM) {
+      ret = (int)send(n->fd, buf, len, 0);
+   } else {
+      ret = (int)sendto(n->fd, buf, len, 0, (struct sockaddr*)&n->addr, n->addr_len);
+   }
+   if (ret > 0) {
+      n->bytes_send += ret;
+   }
+   return ret;
+}
+
+int mnet_chann_send(chann_t *n, void *buf, int len) {
+   if ( n ) {
+      int ret = len;
+      rwb_head_t *prh = &n->rwb_send;
+
+#ifdef MNET_USE_IOURING
+      if (n->ss->engine==MNET_ENGINE_IOURING && n->type==CHANN_TYPE_STREAM) {
+         /* submit send op in poll */
+         _rwb_cache(prh, (char*)buf, len);
+         _event_update(n->ss, n);
+         _chann_check_mark(n);
+         return ret;
+      }
+#endif
+      if ( _chann_corking(n) ) {
+         _rwb_cache(prh, (char*)buf, len);
+         _chann_cork_check(n);
+      }
+      else if (_rwb_count(prh)>0 || _chann_connecting(n)) {
+         _rwb_cache(prh, (char*)buf, len);
+         _chann_check_mark(n);
+      }
+      else {
+         ret = _chann_send(n, buf, len);
+         if (ret < 0) {
+            if (errno != EWOULDBLOCK) {
+               /* perror("chann send: "); */
+               _chann_set_closing(n->ss, n);
+               return ret;
+            }
+            ret = 0;
+         }
+         if (ret < len) {
+            /* cache the rest, wait for writable */
+            _rwb_cache(prh, ((char*)buf) + ret, len - ret);
+            _event_update(n->ss, n);
+            _log("chann %p cache %d of %d\n", n, len - ret, len);
+            _chann_check_mark(n);
+            ret = len;
          }
-      } else {
-         n->bytes_recv += ret;
       }
       return ret;
    }
@@ -542,41 +1996,126 @@ int mnet_chann_recv(chann_t *n, void *buf, int len) {
    return -1;
 }
 
+#ifndef _WIN32
 static int
-_chann_send(chann_t *n, void *buf, int len) {
+_chann_sendv(chann_t *n, const struct iovec *iov, int iovcnt) {
    int ret = 0;
-   if (n->type == CHANN_TYPE_STREAM) {
-      ret = (int)send(n->fd, buf, len, 0);
-   } else {
-      ret = (int)sendto(n->fd, buf, len, 0, (struct sockaddr*)&n->addr, n->addr_len);
+   struct msghdr msg;
+   memset(&msg, 0, sizeof(msg));
+   if (n->type != CHANN_TYPE_STREAM) {
+      msg.msg_name = &n->addr;
+      msg.msg_namelen = n->addr_len;
    }
+   msg.msg_iov = (struct iovec*)iov;
+   msg.msg_iovlen = iovcnt;
+   ret = (int)sendmsg(n->fd, &msg, 0);
    if (ret > 0) {
       n->bytes_send += ret;
    }
    return ret;
 }
+#endif
 
-int mnet_chann_send(chann_t *n, void *buf, int len) {
-   if ( n ) {
-      int ret = len;
+int mnet_chann_sendv(chann_t *n, const struct iovec *iov, int iovcnt) {
+   if (n && iov && iovcnt>0) {
+#ifdef _WIN32
+      int i = 0, ret = 0;
+      for (i=0; i<iovcnt; i++) {
+         if (mnet_chann_send(n, iov[i].iov_base, (int)iov[i].iov_len) < 0) {
+            return -1;
+         }
+         ret += (int)iov[i].iov_len;
+      }
+      return ret;
+#else
+      mnet_t *ss = n->ss;
       rwb_head_t *prh = &n->rwb_send;
+      int i = 0, total = 0, ret = 0;
 
-      if (_rwb_count(prh) > 0) {
-         _rwb_cache(prh, (char*)buf, len);
+      for (i=0; i<iovcnt; i++) {
+         total += (int)iov[i].iov_len;
       }
-      else {
+
+      if ( _chann_corking(n) ) {
+         for (i=0; i<iovcnt; i++) {
+            _rwb_cache(prh, (char*)iov[i].iov_base, (int)iov[i].iov_len);
+         }
+         _chann_cork_check(n);
+         return total;
+      }
+
+      if ((_rwb_count(prh) <= 0) && (ss->engine != MNET_ENGINE_IOURING) &&
+          !_chann_connecting(n))
+      {
+         ret = _chann_sendv(n, iov, iovcnt);
+         if (ret < 0) {
+            if (errno != EWOULDBLOCK) {
+               _chann_set_closing(ss, n);
+               return ret;
+            }
+            ret = 0;
+         }
+      }
+
+      if (ret < total) {
+         /* skip sent bytes, cache the rest */
+         for (i=0; i<iovcnt; i++) {
+            int len = (int)iov[i].iov_len;
+            if (ret >= len) {
+               ret -= len;
+               continue;
+            }
+            _rwb_cache(prh, (char*)iov[i].iov_base + ret, len - ret);
+            ret = 0;
+         }
+         _event_update(ss, n);
+         _chann_check_mark(n);
+      }
+      return total;
+#endif
+   }
+   assert(n);
+   return -1;
+}
+
+int mnet_chann_send_owned(chann_t *n, void *buf, int len,
+                          chann_release_cb release, void *ud)
+{
+   if (n && buf && len>0) {
+      mnet_t *ss = n->ss;
+      rwb_head_t *prh = &n->rwb_send;
+      int ret = 0;
+
+      if ( _chann_corking(n) ) {
+         _rwb_cache_owned(prh, (char*)buf, 0, len, release, ud);
+         _chann_cork_check(n);
+         return len;
+      }
+
+      if ((_rwb_count(prh) <= 0) && (ss->engine != MNET_ENGINE_IOURING) &&
+          !_chann_connecting(n))
+      {
          ret = _chann_send(n, buf, len);
-         if (ret <= 0) {
+         if (ret < 0) {
             if (errno != EWOULDBLOCK) {
-               /* perror("chann send: "); */
-               n->state = CHANN_STATE_CLOSING;
+               _chann_set_closing(ss, n);
+               goto release;
             }
-         } else if (ret < len) {
-            _rwb_cache(prh, ((char*)buf) + ret, len - ret);
-            printf("------------ cache %d of %d!\n", ret, len);
-            ret = len;
+            ret = 0;
          }
       }
+
+      if (ret < len) {
+         _rwb_cache_owned(prh, (char*)buf, ret, len, release, ud);
+         _event_update(ss, n);
+         _chann_check_mark(n);
+         return len;
+      }
+
+     release:
+      if ( release ) {
+         release(buf, ud);
+      }
       return ret;
    }
    assert(n);
@@ -584,19 +2123,42 @@ int mnet_chann_send(chann_t *n, void *buf, int len) {
 }
 
 int mnet_chann_cached(chann_t *n) {
-   rwb_head_t *prh = &n->rwb_send;
-   if (n && _rwb_count(prh) > 0) {
-      rwb_t *b = prh->head;
-      int i = 0, bytes = 0;
-      for (i=0; i<_rwb_count(prh); i++) {
-         bytes += _rwb_buffered(b);
-         b = b->next;
+   return n ? n->rwb_send.bytes : 0;
+}
+
+int mnet_chann_unsent(chann_t *n) {
+   if ( n ) {
+      int unsent = n->rwb_send.bytes;
+#ifdef SIOCOUTQNSD
+      int kernel = 0;
+      if (n->type==CHANN_TYPE_STREAM && n->fd>=0 &&
+          ioctl(n->fd, SIOCOUTQNSD, &kernel)==0)
+      {
+         unsent += kernel;
       }
-      return bytes;
+#endif
+      return unsent;
    }
    return 0;
 }
 
+void mnet_chann_set_cork(chann_t *n, int size) {
+   if ( n ) {
+      n->cork_size = _MAX_OF(size, 0);
+      if (n->cork_size<=0 && n->cork_queued) {
+         _chann_uncork(n->ss, n);
+      }
+   }
+}
+
+int mnet_chann_flush(chann_t *n) {
+   if ( n ) {
+      _chann_uncork(n->ss, n);
+      return n->rwb_send.bytes;
+   }
+   return -1;
+}
+
 char* mnet_chann_addr(chann_t *n) {
    if ( n ) {
       return inet_ntoa(n->addr.sin_addr);
@@ -618,11 +2180,164 @@ long long mnet_chann_bytes(chann_t *n, int be_send) {
    return -1;
 }
 
-int
-mnet_poll(int microseconds) {
-   int nfds = 0;
+/* flush rwb_send chain, in one writev for stream
+ */
+static int
+_chann_flush(mnet_t *ss, chann_t *n) {
+   rwb_head_t *prh = &n->rwb_send;
+   int ret = 0;
+
+#ifndef _WIN32
+   if (n->type == CHANN_TYPE_STREAM) {
+      struct iovec iov[IOV_MAX];
+      int iovcnt = _rwb_drain_iov(prh, iov, IOV_MAX);
+      ret = (int)writev(n->fd, iov, iovcnt);
+      if (ret > 0) {
+         n->bytes_send += ret;
+      }
+   } else
+#endif
+   {
+      int len = 0;
+      char *buf = _rwb_drain_param(prh, &len);
+      ret = _chann_send(n, buf, len);
+   }
+
+   if (ret > 0) {
+      _rwb_drain(prh, ret);
+      if (_rwb_count(prh) <= 0) {
+         _event_update(ss, n);
+      }
+      _chann_check_mark(n);
+   }
+   else if (ret<0 && errno!=EWOULDBLOCK && errno!=EINTR) {
+      _chann_set_closing(ss, n);
+   }
+   return ret;
+}
+
+/* write corked data, the rest waits writable, io_uring never corks and
+   its ring may have sends in flight on rwb_send */
+static void
+_chann_uncork(mnet_t *ss, chann_t *n) {
+   if ( n->cork_queued ) {
+      _chann_unlink_corked(ss, n);
+   }
+   if (n->state==CHANN_STATE_CONNECTED && _rwb_count(&n->rwb_send)>0 &&
+       ss->engine!=MNET_ENGINE_IOURING)
+   {
+      _chann_flush(ss, n);
+      if (_rwb_count(&n->rwb_send) > 0) {
+         _event_update(ss, n);
+      }
+   }
+}
+
+static void
+_chann_process_corked(mnet_t *ss) {
+   while ( ss->corked ) {
+      chann_t *n = ss->corked;
+      ss->corked = n->cork_next;
+      n->cork_next = NULL;
+      n->cork_queued = 0;
+      _chann_uncork(ss, n);
+   }
+}
+
+static int
+_chann_recv_budget_out(mnet_t *ss) {
+   return ss->recv_budget>0 && ss->recv_used>=ss->recv_budget;
+}
+
+/* RECV events till socket drained, chann quantum used or poll budget out,
+ * callback not reading also stops */
+static void
+_chann_dispatch_recv(mnet_t *ss, chann_t *n) {
+   int64_t start = n->bytes_recv;
+   if ( _chann_recv_budget_out(ss) ) {
+      return;                   /* still readable, served next poll */
+   }
+   for (;;) {
+      int64_t last = n->bytes_recv;
+      n->recv_drained = 0;
+      _chann_event(n, MNET_EVENT_RECV, NULL);
+      if (n->bytes_recv==last || n->recv_drained ||
+          n->state!=CHANN_STATE_CONNECTED || !n->active_recv_event ||
+          n->bytes_recv - start >= ss->recv_quantum ||
+          (ss->recv_budget>0 &&
+           ss->recv_used + (n->bytes_recv - start) >= ss->recv_budget))
+      {
+         break;
+      }
+   }
+   ss->recv_used += (int)(n->bytes_recv - start);
+}
+
+/* dispatch chann events
+ */
+static void
+_chann_dispatch(mnet_t *ss, chann_t *n, int rd, int wr, int er) {
+   switch ( n->state ) {
+      case CHANN_STATE_LISTENING:
+         if (rd && n->active_recv_event) {
+            if (n->type == CHANN_TYPE_STREAM) {
+               _chann_accept_burst(ss, n, n->accept_budget);
+            } else {
+               _chann_event(n, MNET_EVENT_RECV, NULL);
+            }
+         }
+         break;
+
+      case CHANN_STATE_CONNECTING:
+         if (wr || er) {
+            int opt=0; socklen_t opt_len=sizeof(opt);
+            getsockopt(n->fd, SOL_SOCKET, SO_ERROR, &opt, &opt_len);
+            if (opt==0 && !er) {
+               n->state = CHANN_STATE_CONNECTED;
+               _event_update(ss, n);
+               _chann_event(n, MNET_EVENT_CONNECT, NULL);
+            } else {
+               _chann_set_closing(ss, n);
+               _chann_event(n, MNET_EVENT_DISCONNECT, NULL);
+            }
+         }
+         break;
+
+      case CHANN_STATE_CONNECTED:
+         if (rd && n->active_recv_event) {
+            _chann_dispatch_recv(ss, n);
+         }
+         if (wr && n->state==CHANN_STATE_CONNECTED) {
+            if (_rwb_count(&n->rwb_send) > 0) {
+               _chann_flush(ss, n);
+            }
+            else if ( n->active_send_event ) {
+               _chann_event(n, MNET_EVENT_SEND, NULL);
+            }
+         }
+         break;
+      default:
+         break;
+   }
+}
+
+/* destroy channs marked closing in this round
+ */
+static void
+_chann_process_closing(mnet_t *ss) {
+   chann_t *n = NULL;
+   while ((n = ss->closing)) {
+      ss->closing = n->close_next;
+      _chann_event(n, MNET_EVENT_CLOSE, NULL);
+      _chann_close(ss, n);
+      _chann_destroy(ss, n);
+   }
+}
+
+static int
+_poll_select(mnet_t *ss, int microseconds) {
+   int nfds = 0, pass = 0, start = 0;
    chann_t *n = NULL;
-   mnet_t *ss = _gmnet();
    fd_set *sr, *sw, *se;
 
    nfds = 0;
@@ -637,7 +2352,9 @@ mnet_poll(int microseconds) {
          case CHANN_STATE_LISTENING:
          case CHANN_STATE_CONNECTED:
             nfds = nfds<=n->fd ? n->fd+1 : nfds;
-            _select_add(ss, n->fd, MNET_SET_READ);
+            if ( n->active_recv_event ) {
+               _select_add(ss, n->fd, MNET_SET_READ);
+            }
             if ((_rwb_count(&n->rwb_send)>0) || n->active_send_event) {
                _select_add(ss, n->fd, MNET_SET_WRITE);
             }
@@ -657,75 +2374,354 @@ mnet_poll(int microseconds) {
    sw = &ss->fdset[MNET_SET_WRITE];
    se = &ss->fdset[MNET_SET_ERROR];
 
-   ss->tv.tv_sec = 0;
-   ss->tv.tv_usec = microseconds;
+   ss->tv.tv_sec = microseconds / 1000000;
+   ss->tv.tv_usec = microseconds % 1000000;
    if (select(nfds, sr, sw, se, microseconds >= 0 ? &ss->tv : NULL) < 0) {
       if (errno != EINTR) {
          perror("select error !\n");
          abort();
          return -1;
       }
+      return 0;
    }
 
-   n = ss->channs;
-   while ( n ) {
-      chann_t *nn = n->next;
-      switch ( n->state ) {
-         case CHANN_STATE_LISTENING:
-            if ( _select_isset(sr, n->fd) ) {
-               if (n->type == CHANN_TYPE_STREAM) {
-                  chann_t *c = _chann_accept(ss, n);
-                  if (c) _chann_event(n, MNET_EVENT_ACCEPT, c);
-               } else {
-                  _chann_event(n, MNET_EVENT_RECV, NULL);
+   /* fds from the one after where last poll's recv budget ran out, then
+      the ones before, for fairness */
+   start = ss->rr_fd;
+   ss->rr_fd = 0;
+   for (pass=0; pass<2; pass++) {
+      n = ss->channs;
+      while ( n ) {
+         chann_t *nn = n->next;
+         int fd = n->fd;
+         if (fd>=0 && (pass==0) == (fd>=start)) {
+            int rd = _select_isset(sr, fd);
+            int wr = _select_isset(sw, fd);
+            int er = _select_isset(se, fd);
+            if (rd || wr || er) {
+               int out = _chann_recv_budget_out(ss);
+               _chann_dispatch(ss, n, rd, wr, er);
+               if (!out && _chann_recv_budget_out(ss)) {
+                  ss->rr_fd = fd + 1;
                }
             }
-            break;
+         }
+         n = nn;
+      }
+   }
+   return 0;
+}
 
-         case CHANN_STATE_CONNECTING:
-            if ( _select_isset(sw, n->fd) ) {
-               int opt=0; socklen_t opt_len=sizeof(opt);
-               getsockopt(n->fd, SOL_SOCKET, SO_ERROR, &opt, &opt_len);
-               if (opt == 0) {
-                  n->state = CHANN_STATE_CONNECTED;
-                  _chann_event(n, MNET_EVENT_CONNECT, NULL);
-               } else {
-                  n->state = CHANN_STATE_CLOSING;
-                  _chann_event(n, MNET_EVENT_DISCONNECT, NULL);
+#ifdef MNET_USE_EPOLL
+static int
+_poll_epoll(mnet_t *ss, int microseconds) {
+   int i = 0, pass = 0, start = 0;
+   int ms = microseconds >= 0 ? (microseconds + 999) / 1000 : -1;
+   int nevs = epoll_wait(ss->epfd, ss->evs, MNET_EPOLL_MAX_EVENTS, ms);
+   if (nevs < 0) {
+      if (errno != EINTR) {
+         perror("epoll error !\n");
+         abort();
+         return -1;
+      }
+      return 0;
+   }
+
+   /* chann destroy deferred to closing list, pointers keep valid. fds from
+      the one after where last poll's recv budget ran out, then the ones
+      before, for fairness as select does */
+   start = ss->rr_fd;
+   ss->rr_fd = 0;
+   for (i=0; i<nevs; i++) {
+      ss->evs_fd[i] = ((chann_t*)ss->evs[i].data.ptr)->fd;
+   }
+   for (pass=0; pass<2; pass++) {
+      for (i=0; i<nevs; i++) {
+         chann_t *n = (chann_t*)ss->evs[i].data.ptr;
+         int ev = ss->evs[i].events;
+         int fd = ss->evs_fd[i];
+         if ((pass==0) != (fd>=start)) {
+            continue;
+         }
+         int out = _chann_recv_budget_out(ss);
+         _chann_dispatch(ss, n,
+                         ev & (EPOLLIN | EPOLLHUP | EPOLLERR),
+                         ev & EPOLLOUT,
+                         ev & EPOLLERR);
+         if (!out && _chann_recv_budget_out(ss)) {
+            ss->rr_fd = fd + 1;
+         }
+      }
+   }
+   return 0;
+}
+#endif
+
+#ifdef MNET_USE_IOURING
+/* submit ops for dirty channs */
+static void
+_uring_arm(mnet_t *ss) {
+   mnet_uring_t *r = &ss->ring;
+   while ( r->dirty ) {
+      chann_t *n = r->dirty;
+      int ops = n->uring_ops;
+      r->dirty = n->dirty_next;
+      n->uring_dirty = 0;
+
+      switch (n->state) {
+         case CHANN_STATE_LISTENING:
+            if ( !n->active_recv_event ) {
+               break;
+            }
+            if (n->type == CHANN_TYPE_STREAM) {
+               if (!(ops & (1<<MNET_URING_OP_ACCEPT))) {
+                  _uring_submit(ss, n, MNET_URING_OP_ACCEPT, IORING_OP_ACCEPT);
                }
             }
-            if ( _select_isset(se, n->fd) ) {
-               n->state = CHANN_STATE_CLOSING;
-               _chann_event(n, MNET_EVENT_DISCONNECT, NULL);
+            else if (!(ops & (1<<MNET_URING_OP_POLL_IN))) {
+               _uring_submit(ss, n, MNET_URING_OP_POLL_IN, IORING_OP_POLL_ADD);
+            }
+            break;
+         case CHANN_STATE_CONNECTING:
+            if (!(ops & (1<<MNET_URING_OP_CONNECT))) {
+               _uring_submit(ss, n, MNET_URING_OP_CONNECT, IORING_OP_CONNECT);
             }
             break;
-
          case CHANN_STATE_CONNECTED:
-            if ( _select_isset(sr, n->fd) ) {
-               _chann_event(n, MNET_EVENT_RECV, NULL);
+            if (n->active_recv_event && !(ops & (1<<MNET_URING_OP_POLL_IN))) {
+               _uring_submit(ss, n, MNET_URING_OP_POLL_IN, IORING_OP_POLL_ADD);
             }
-            if ( _select_isset(sw, n->fd) ) {
-               rwb_head_t *prh = &n->rwb_send;
-               if (_rwb_count(prh) > 0) {
-                  int ret=0, len=0;
-                  char *buf = _rwb_drain_param(prh, &len);
-                  ret = _chann_send(n, buf, len);
-                  if (ret > 0) _rwb_drain(prh, ret);
-               }
-               else if ( n->active_send_event ) {
-                  _chann_event(n, MNET_EVENT_SEND, NULL);
+            if (_rwb_count(&n->rwb_send) > 0) {
+               if (!(ops & (1<<MNET_URING_OP_SEND))) {
+                  _uring_submit(ss, n, MNET_URING_OP_SEND, IORING_OP_SENDMSG);
                }
             }
+            else if (n->active_send_event && !(ops & (1<<MNET_URING_OP_POLL_OUT))) {
+               _uring_submit(ss, n, MNET_URING_OP_POLL_OUT, IORING_OP_POLL_ADD);
+            }
             break;
          default:
             break;
       }
-      if (n->state == CHANN_STATE_CLOSING) {
-         _chann_event(n, MNET_EVENT_CLOSE, NULL);
-         _chann_close(ss, n);
-         _chann_destroy(ss, n);
+   }
+}
+
+static void
+_uring_complete(mnet_t *ss, chann_t *n, int op, int res) {
+   switch (op) {
+      case MNET_URING_OP_POLL_IN:
+         if (res>0 && n->active_recv_event) {
+            if (n->state == CHANN_STATE_CONNECTED) {
+               _chann_dispatch_recv(ss, n);
+            } else if (n->state == CHANN_STATE_LISTENING) {
+               _chann_event(n, MNET_EVENT_RECV, NULL);
+            }
+         }
+         break;
+
+      case MNET_URING_OP_POLL_OUT:
+         if (res>0 && n->state==CHANN_STATE_CONNECTED) {
+            if (_rwb_count(&n->rwb_send)<=0 && n->active_send_event) {
+               _chann_event(n, MNET_EVENT_SEND, NULL);
+            }
+         }
+         break;
+
+      case MNET_URING_OP_SEND:
+         if (n->state == CHANN_STATE_CONNECTED) {
+            if (res > 0) {
+               n->bytes_send += res;
+               _rwb_drain(&n->rwb_send, res);
+               _chann_check_mark(n);
+            }
+            else if (res!=-EAGAIN && res!=-EINTR) {
+               _chann_set_closing(ss, n);
+            }
+         }
+         break;
+
+      case MNET_URING_OP_CONNECT:
+         if (n->state == CHANN_STATE_CONNECTING) {
+            if (res == 0) {
+               n->state = CHANN_STATE_CONNECTED;
+               _chann_event(n, MNET_EVENT_CONNECT, NULL);
+            } else {
+               _chann_set_closing(ss, n);
+               _chann_event(n, MNET_EVENT_DISCONNECT, NULL);
+            }
+         }
+         break;
+
+      case MNET_URING_OP_ACCEPT:
+         if (res >= 0) {
+            if (n->state == CHANN_STATE_LISTENING) {
+               chann_t *c = _chann_create(ss, n->type, CHANN_STATE_CONNECTED);
+               c->fd = res;
+               c->addr = n->acc_addr;
+               c->addr_len = n->acc_len;
+               _event_update(ss, c);
+               _chann_event(n, MNET_EVENT_ACCEPT, c);
+               /* drain backlog without waiting another round */
+               _chann_accept_burst(ss, n, n->accept_budget - 1);
+            } else {
+               close(res);
+            }
+         }
+         break;
+   }
+   _event_update(ss, n);        /* re-arm */
+}
+
+static int
+_poll_uring(mnet_t *ss, int microseconds) {
+   mnet_uring_t *r = &ss->ring;
+   struct io_uring_getevents_arg arg;
+   struct __kernel_timespec ts;
+   unsigned head = 0;
+   int ret = 0;
+
+   _uring_arm(ss);
+
+   memset(&arg, 0, sizeof(arg));
+   if (microseconds >= 0) {
+      ts.tv_sec = microseconds / 1000000;
+      ts.tv_nsec = (microseconds % 1000000) * 1000;
+      arg.ts = (__u64)(uintptr_t)&ts;
+   }
+   ret = _uring_enter(r->fd, r->to_submit, 1,
+                      IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG,
+                      &arg, sizeof(arg));
+   if (ret < 0) {
+      if (errno!=EINTR && errno!=ETIME && errno!=EBUSY) {
+         perror("io_uring error !\n");
+         abort();
+         return -1;
+      }
+   } else {
+      r->to_submit -= _MIN_OF((unsigned)ret, r->to_submit);
+   }
+
+   head = *r->cq_head;
+   while (head != __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE)) {
+      struct io_uring_cqe *cqe = &r->cqes[head & *r->cq_mask];
+      chann_t *n = (chann_t*)(uintptr_t)(cqe->user_data & ~(__u64)MNET_URING_OP_MASK);
+      int op = (int)(cqe->user_data & MNET_URING_OP_MASK);
+      int res = cqe->res;
+
+      __atomic_store_n(r->cq_head, ++head, __ATOMIC_RELEASE);
+
+      if (n == NULL) {
+         continue;              /* cancel op */
+      }
+      n->uring_ops &= ~(1 << op);
+      if ( n->uring_zombie ) {
+         if (n->uring_ops == 0) {
+            _chann_unlink_zombie(ss, n);
+            _rwb_destroy(&n->rwb_send);
+            mm_free(n);
+         }
+         continue;
+      }
+      _uring_complete(ss, n, op, res);
+      head = *r->cq_head;
+   }
+   return 0;
+}
+#endif
+
+int
+mnet_poll(int microseconds) {
+   return mnet_ctx_poll(_gmnet(), microseconds);
+}
+
+int
+mnet_ctx_poll(mnet_ctx_t *ctx, int microseconds) {
+   mnet_t *ss = ctx;
+   if (ss==NULL || !ss->init) {
+      return -1;
+   }
+
+#ifdef MSG_FASTOPEN
+   _chann_process_fastopen(ss);
+#endif
+   _chann_process_corked(ss);   /* sent out of poll */
+   ss->recv_used = 0;
+
+   if (ss->wheel.count > 0) {
+      /* wake up for next timer */
+      int ms = _wheel_next(&ss->wheel);
+      if (microseconds<0 || ms < microseconds/1000) {
+         microseconds = ms * 1000;
       }
-      n = nn;
    }
+
+   switch (ss->engine) {
+#ifdef MNET_USE_IOURING
+      case MNET_ENGINE_IOURING:
+         _poll_uring(ss, microseconds);
+         break;
+#endif
+#ifdef MNET_USE_EPOLL
+      case MNET_ENGINE_EPOLL:
+         _poll_epoll(ss, microseconds);
+         break;
+#endif
+      default:
+         _poll_select(ss, microseconds);
+         break;
+   }
+
+   _wheel_run(&ss->wheel);
+   _chann_process_corked(ss);
+   _chann_process_closing(ss);
    return ss->chann_count;
 }
+
+/* timer api
+ */
+mnet_timer_t*
+mnet_timer_add(int milliseconds, int interval, mnet_timer_cb cb, void *ud) {
+   return mnet_ctx_timer_add(_gmnet(), milliseconds, interval, cb, ud);
+}
+
+mnet_timer_t*
+mnet_ctx_timer_add(mnet_ctx_t *ctx, int milliseconds, int interval,
+                   mnet_timer_cb cb, void *ud)
+{
+   if (ctx && ctx->init && cb) {
+      struct s_mtimer *t = (struct s_mtimer*)mm_malloc(sizeof(*t));
+      _tnode_init(&t->node);
+      t->expire = _wheel_now() + _MAX_OF(milliseconds, 0);
+      t->interval = _MAX_OF(interval, 0);
+      t->cb = cb;
+      t->ud = ud;
+      t->ss = ctx;
+      _wheel_add(&ctx->wheel, t);
+      ctx->wheel.count++;
+      return t;
+   }
+   return NULL;
+}
+
+void
+mnet_timer_reset(mnet_timer_t *t, int milliseconds) {
+   if ( t ) {
+      _tnode_del(&t->node);
+      t->canceled = 0;
+      t->expire = _wheel_now() + _MAX_OF(milliseconds, 0);
+      _wheel_add(&t->ss->wheel, t);
+   }
+}
+
+void
+mnet_timer_cancel(mnet_timer_t *t) {
+   if ( t ) {
+      _tnode_del(&t->node);
+      if ( t->firing ) {
+         t->canceled = 1;       /* free after callback */
+      } else {
+         t->ss->wheel.count--;
+         mm_free(t);
+      }
+   }
+}
@@ -8,6 +8,17 @@
 #ifndef MNET_H
 #define MNET_H
 
+#include <stddef.h>
+
+#ifdef _WIN32
+struct iovec {
+   void *iov_base;
+   size_t iov_len;
+};
+#else
+#include <sys/uio.h>
+#endif
+
 #ifndef MNET_BUF_SIZE
 #define MNET_BUF_SIZE (64*1024) /* 64kb */
 #endif
@@ -33,8 +44,18 @@ typedef enum {
    MNET_EVENT_ACCEPT,       /* tcp accept */
    MNET_EVENT_CONNECT,      /* tcp connect */
    MNET_EVENT_DISCONNECT,   /* tcp disconnect */
+   MNET_EVENT_SEND_HIGH,    /* send queue over high watermark */
+   MNET_EVENT_SEND_LOW,     /* send queue drained to low watermark */
 } mnet_event_type_t;
 
+typedef enum {
+   MNET_ENGINE_DEFAULT = 0,     /* epoll under Linux, or select */
+   MNET_ENGINE_SELECT,
+   MNET_ENGINE_EPOLL,
+   MNET_ENGINE_IOURING,         /* fallback to epoll/select if unavailable */
+} mnet_engine_t;
+
+typedef struct s_mnet mnet_ctx_t;
 typedef struct s_mchann chann_t;
 typedef struct {
    mnet_event_type_t event;
@@ -44,16 +65,50 @@ typedef struct {
 } chann_event_t;
 
 typedef void (*chann_cb)(chann_event_t*);
+typedef void (*chann_release_cb)(void *buf, void *ud);
+
+typedef struct s_mtimer mnet_timer_t;
+typedef void (*mnet_timer_cb)(mnet_timer_t *t, void *ud);
 
 /* support limited connections */
 int mnet_init(void);
+int mnet_init_ex(mnet_engine_t engine);
 void mnet_fini(void);
 
+mnet_engine_t mnet_engine(void);
+
 int mnet_poll(int microseconds);
 int mnet_report(int level);
+void mnet_set_recv_budget(int budget, int quantum);
+
+/* contexts, each with its own channs, buffers and stats, poll one context
+   in one thread. functions above work on default context */
+mnet_ctx_t* mnet_ctx_default(void);
+mnet_ctx_t* mnet_ctx_create(mnet_engine_t engine);
+void mnet_ctx_destroy(mnet_ctx_t *ctx);
+
+mnet_engine_t mnet_ctx_engine(mnet_ctx_t *ctx);
+
+int mnet_ctx_poll(mnet_ctx_t *ctx, int microseconds);
+
+/* RECV events repeat on a chann till drained or quantum bytes read, and
+   stop for all channs when budget bytes read in one poll, the rest served
+   first in next poll. budget 0 for unlimited */
+void mnet_ctx_set_recv_budget(mnet_ctx_t *ctx, int budget, int quantum);
+int mnet_ctx_report(mnet_ctx_t *ctx, int level);
+
+/* timers fired in poll, repeat every interval ms when interval > 0. handle
+   freed when canceled, or after once timer callback unless reset in it */
+mnet_timer_t* mnet_timer_add(int milliseconds, int interval, mnet_timer_cb cb, void *ud);
+mnet_timer_t* mnet_ctx_timer_add(mnet_ctx_t *ctx, int milliseconds, int interval,
+                                 mnet_timer_cb cb, void *ud);
+void mnet_timer_reset(mnet_timer_t *t, int milliseconds);
+void mnet_timer_cancel(mnet_timer_t *t);
 
 /* channels */
 chann_t* mnet_chann_open(chann_type_t type);
+chann_t* mnet_ctx_chann_open(mnet_ctx_t *ctx, chann_type_t type);
+mnet_ctx_t* mnet_chann_ctx(chann_t *n);
 void mnet_chann_close(chann_t *n);
 
 int mnet_chann_state(chann_t *n);
@@ -65,12 +120,55 @@ int mnet_chann_listen_ex(chann_t *n, const char *host, int port, int backlog);
 #define mnet_chann_listen(n, p) mnet_chann_listen_ex(n, NULL, p, 5)
 
 void mnet_chann_set_cb(chann_t *n, chann_cb cb, void *opaque);
+/* MNET_EVENT_SEND or MNET_EVENT_RECV, inactive RECV pause reading */
 void mnet_chann_active_event(chann_t *n, mnet_event_type_t et, int active);
 
+/* socket options, kept and applied when socket opened if set before
+   connect or listen, accepted channels inherit from listener except
+   AUTOTUNE; buffers left to kernel autotuning when never set */
+typedef enum {
+   MNET_OPT_SNDBUF = 0,         /* bytes */
+   MNET_OPT_RCVBUF,
+   MNET_OPT_NODELAY,            /* 0 or 1 */
+   MNET_OPT_NOTSENT_LOWAT,      /* bytes unsent in kernel before EAGAIN */
+   MNET_OPT_KEEPALIVE,          /* idle seconds before probe, 0 to disable */
+   MNET_OPT_KEEPINTVL,          /* seconds between probes */
+   MNET_OPT_KEEPCNT,            /* probes before drop */
+   MNET_OPT_FASTOPEN,           /* listener queue length, or 1 for client to
+                                   send data cached before next poll in SYN */
+   MNET_OPT_LINGER,             /* seconds close waits unsent, 0 to reset */
+   MNET_OPT_AUTOTUNE,           /* max buffer bytes sized from TCP_INFO, 0 to stop */
+   MNET_OPT_MAX,
+} mnet_opt_t;
+
+int mnet_chann_setopt(chann_t *n, mnet_opt_t opt, int value);
+int mnet_chann_getopt(chann_t *n, mnet_opt_t opt);
+
+/* max ACCEPT events for listener in one poll, 0 for default */
+void mnet_chann_set_accept_budget(chann_t *n, int budget);
+
+/* SEND_HIGH/SEND_LOW event when cached bytes cross, high 0 to disable */
+void mnet_chann_set_watermark(chann_t *n, int low, int high);
+
 int mnet_chann_recv(chann_t *n, void *buf, int len);
 int mnet_chann_send(chann_t *n, void *buf, int len);
+int mnet_chann_sendv(chann_t *n, const struct iovec *iov, int iovcnt);
+
+/* buf kept in send queue without copy, release called when sent or
+   chann destroyed */
+int mnet_chann_send_owned(chann_t *n, void *buf, int len,
+                          chann_release_cb release, void *ud);
 
 int mnet_chann_cached(chann_t *n);
+/* cached bytes and kernel bytes not sent yet where supported */
+int mnet_chann_unsent(chann_t *n);
+
+/* batch stream sends in one poll round, written when the round ends or
+   cached bytes reach size, 0 to disable */
+void mnet_chann_set_cork(chann_t *n, int size);
+/* write batched sends now, io_uring leaves them to the ring, return bytes
+   still cached */
+int mnet_chann_flush(chann_t *n);
 char* mnet_chann_addr(chann_t *n);
 int mnet_chann_port(chann_t *n);
 
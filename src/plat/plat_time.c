@@ -16,6 +16,7 @@
 #endif
 
 #include <sys/time.h>
+#include <time.h>
 #include <unistd.h>
 
 #endif
@@ -36,6 +37,17 @@ int64_t mtime_current(void) {
 #endif
 }
 
+/* micro second, not affected by system time change */
+int64_t mtime_monotonic(void) {
+#ifdef PLAT_OS_WIN
+   return (int64_t)GetTickCount64() * 1000;
+#else
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#endif
+}
+
 void mtime_sleep(int millisecond) {
 #ifdef PLAT_OS_WIN
    Sleep(millisecond);
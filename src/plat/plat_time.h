@@ -14,6 +14,7 @@
 #define MTIME_MILLI_PER_SEC 1000
 
 int64_t mtime_current(void);    /* in micro sec */
+int64_t mtime_monotonic(void);  /* in micro sec, monotonic */
 void mtime_sleep(int millisecond);
 
 #endif
@@ -16,26 +16,288 @@
 
 int
 tunnel_cmd_check(buf_t *b, tunnel_cmd_t *cmd) {
-   if (b && cmd && buf_buffered(b)>=TUNNEL_CMD_CONST_HEADER_LEN) {
+   if (b && cmd) {
+      return tunnel_cmd_parse(buf_addr(b,buf_ptr(b)), buf_buffered(b), cmd);
+   }
+   return 0;
+}
+
+/* varint at d, return bytes used, 0 for truncated or over 5 bytes */
+static int
+_cmd_varint_get(const unsigned char *d, int len, int *value) {
+   unsigned v = 0;
+   int max = len < 5 ? len : 5;
+   for (int i=0; i<max; i++) {
+      v |= (unsigned)(d[i] & 0x7f) << (7 * i);
+      if (d[i] < 0x80) {
+         *value = (int)v;
+         return i + 1;
+      }
+   }
+   return 0;
+}
+
+static int
+_cmd_varint_put(unsigned char *d, int value) {
+   unsigned v = (unsigned)value;
+   int n = 0;
+   while (v >= 0x80) {
+      d[n++] = (unsigned char)(v | 0x80);
+      v >>= 7;
+   }
+   d[n++] = (unsigned char)v;
+   return n;
+}
+
+/* compact head frame, data_len filled as classic one */
+static int
+_cmd_parse_compact(unsigned char *d, int len, tunnel_cmd_t *cmd) {
+   int full = d[0] & 0x08;
+   int n = (len > 2) ? _cmd_varint_get(&d[2], len - 2, &cmd->chann_id) : 0;
+   int hlen = 2 + n + (full ? 4 : 0);
+   if (n<=0 || len<hlen) {
+      return 0;
+   }
+
+   cmd->cmd = d[0] >> 4;
+   cmd->magic = ((d[0] & 0x07) << 8) | d[1];
+   cmd->magic_mask = TUNNEL_CMD_COMPACT_GEN_MASK;
+   if ( full ) {
+      cmd->magic = (d[2+n]<<24) | (d[3+n]<<16) | (d[4+n]<<8) | d[5+n];
+      cmd->magic_mask = 0;
+   }
+   cmd->payload = &d[hlen];
+   cmd->data_len = TUNNEL_CMD_CONST_HEADER_LEN + len - hlen;
+   cmd->head = TUNNEL_CMD_HEAD_COMPACT;
+   return 1;
+}
+
+int
+tunnel_cmd_parse(unsigned char *d, int len, tunnel_cmd_t *cmd) {
+   if (d && cmd && len>0 && d[0]>=0x10) {
+      memset(cmd, 0, sizeof(*cmd));
+      return _cmd_parse_compact(d, len, cmd);
+   }
+   if (d && cmd && len>=TUNNEL_CMD_CONST_HEADER_LEN) {
       memset(cmd, 0, sizeof(*cmd));
 
-      unsigned char *d = buf_addr(b,buf_ptr(b));
       cmd->data_len = tunnel_cmd_data_len(d, 0, 0);
       cmd->chann_id = tunnel_cmd_chann_id(d, 0, 0);
       cmd->magic = tunnel_cmd_chann_magic(d, 0, 0);
       cmd->cmd = tunnel_cmd_head_cmd(d, 0, 0);
       cmd->payload = &d[TUNNEL_CMD_CONST_HEADER_LEN];
 
-      if (buf_buffered(b) >= cmd->data_len) {
+      if (len >= cmd->data_len) {
          /* _verbose("chann %d:%d cmd %d, length %d\n", cmd->chann_id, */
          /*          cmd->magic, cmd->cmd, cmd->data_len); */
          return 1;
       }
-      /* _err("not enought data %d:%d !\n", buf_buffered(b), cmd->data_len); */
+      /* _err("not enought data %d:%d !\n", len, cmd->data_len); */
    }
    return 0;
 }
 
+int
+tunnel_cmd_magic_match(tunnel_cmd_t *cmd, int magic) {
+   if (cmd && cmd->magic_mask) {
+      return (magic & cmd->magic_mask) == cmd->magic;
+   }
+   return cmd && (cmd->magic == magic);
+}
+
+int
+tunnel_cmd_pack(int head, unsigned char *d, int len, unsigned char **out) {
+   int hlen = TUNNEL_CMD_CONST_HEADER_LEN;
+   if (d==NULL || out==NULL || len<hlen) {
+      return -1;
+   }
+   if (head != TUNNEL_CMD_HEAD_COMPACT) {
+      *out = d;
+      return len;
+   }
+
+   unsigned char h[TUNNEL_CMD_CONST_HEADER_LEN];
+   int cmd = tunnel_cmd_head_cmd(d, 0, 0);
+   int magic = tunnel_cmd_chann_magic(d, 0, 0);
+   int full = (cmd == TUNNEL_CMD_CONNECT);
+
+   h[0] = (unsigned char)((cmd << 4) | (full ? 0x08 : 0) | ((magic >> 8) & 0x07));
+   h[1] = (unsigned char)(magic & 0xff);
+   int n = 2 + _cmd_varint_put(&h[2], tunnel_cmd_chann_id(d, 0, 0));
+   if ( full ) {
+      memcpy(&h[n], &d[3 + 4], 4);
+      n += 4;
+   }
+
+   *out = &d[hlen - n];
+   memcpy(*out, h, n);
+   return len - hlen + n;
+}
+
+unsigned char*
+tunnel_cmd_unit(unsigned char *frame, int *unit_len) {
+   if (frame==NULL || unit_len==NULL) {
+      return NULL;
+   }
+   if (frame[0] >= 0x10) {
+      return frame;
+   }
+   *unit_len -= 3;
+   return &frame[3];
+}
+
+unsigned char*
+tunnel_cmd_unit_frame(unsigned char *frame, int *frame_len) {
+   if (frame==NULL || frame_len==NULL || *frame_len<=3) {
+      return NULL;
+   }
+   if (frame[3] >= 0x10) {
+      *frame_len -= 3;
+      return &frame[3];
+   }
+   tunnel_cmd_data_len(frame, 1, *frame_len);
+   return frame;
+}
+
+int
+tunnel_cmd_decode(buf_t *b, tunnel_cmd_frame_cb cb, void *ud) {
+   int count = 0;
+   if (b==NULL || cb==NULL) {
+      return -1;
+   }
+
+   /* 3 bytes length head, unit may be shorter than classic head */
+   while (buf_buffered(b) >= 3) {
+      unsigned char *d = buf_addr(b,buf_ptr(b));
+      int len = tunnel_cmd_data_len(d, 0, 0);
+      if (len<=3 || len>buf_len(b)) {
+         _err("invalid frame length %d\n", len);
+         return -1;
+      }
+      if (buf_buffered(b) < len) {
+         break;
+      }
+      /* b may be destroyed in cb */
+      buf_forward_ptr(b, len);
+      if (cb(d, len, ud) < 0) {
+         return -1;
+      }
+      count++;
+   }
+
+   /* move partial frame to head */
+   if (buf_ptr(b) > 0) {
+      int left = buf_buffered(b);
+      if (left > 0) {
+         memmove(buf_addr(b,0), buf_addr(b,buf_ptr(b)), left);
+      }
+      buf_reset(b);
+      buf_forward_ptw(b, left);
+   }
+   return count;
+}
+
+/* next frame in record payload, return bytes used, 0 for invalid */
+static int
+_cmd_record_next(int head, unsigned char *d, int len, unsigned char **frame, int *frame_len) {
+   int n = 0;
+   if (head == TUNNEL_CMD_HEAD_COMPACT) {
+      n = _cmd_varint_get(d, len, frame_len);
+      *frame = &d[n];
+      if (n<=0 || *frame_len<=2 || *frame_len>len-n || (d[n]>>4)==TUNNEL_CMD_RECORD) {
+         return 0;
+      }
+   }
+   else {
+      *frame_len = tunnel_cmd_data_len(d, 0, 0);
+      *frame = d;
+      if (len<TUNNEL_CMD_CONST_HEADER_LEN || *frame_len<TUNNEL_CMD_CONST_HEADER_LEN ||
+          *frame_len>len || tunnel_cmd_head_cmd(d, 0, 0)==TUNNEL_CMD_RECORD)
+      {
+         return 0;
+      }
+   }
+   return n + *frame_len;
+}
+
+int
+tunnel_cmd_record_split(int head, unsigned char *payload, int payload_len,
+                        tunnel_cmd_frame_cb cb, void *ud)
+{
+   int count = 0;
+   if (payload==NULL || cb==NULL) {
+      return -1;
+   }
+
+   while (payload_len > 0) {
+      unsigned char *frame = NULL;
+      int len = 0;
+      int used = _cmd_record_next(head, payload, payload_len, &frame, &len);
+      if (used <= 0) {
+         _err("invalid record frame length %d:%d\n", len, payload_len);
+         return -1;
+      }
+      if (cb(frame, len, ud) < 0) {
+         return -1;
+      }
+      payload += used;
+      payload_len -= used;
+      count++;
+   }
+   return count;
+}
+
+int
+tunnel_cmd_record_append(buf_t *r, int head, unsigned char *frame, int frame_len) {
+   int hlen = TUNNEL_CMD_CONST_HEADER_LEN;
+   unsigned char prefix[5];
+   int n = 0;
+   if (r==NULL || frame==NULL || frame_len<=0) {
+      return 0;
+   }
+   if (head == TUNNEL_CMD_HEAD_COMPACT) {
+      n = _cmd_varint_put(prefix, frame_len);
+   }
+   if (buf_ptw(r) <= 0) {
+      buf_reset(r);
+      buf_forward_ptw(r, hlen);
+   }
+   if (buf_ptw(r) + n + frame_len > buf_len(r)) {
+      return 0;
+   }
+   memcpy(buf_addr(r,buf_ptw(r)), prefix, n);
+   memcpy(buf_addr(r,buf_ptw(r) + n), frame, frame_len);
+   buf_forward_ptw(r, n + frame_len);
+   return 1;
+}
+
+unsigned char*
+tunnel_cmd_record_seal(buf_t *r, int head, int *frame_len) {
+   int hlen = TUNNEL_CMD_CONST_HEADER_LEN;
+   if (r==NULL || frame_len==NULL || buf_ptw(r)<=hlen) {
+      return NULL;
+   }
+
+   unsigned char *d = buf_addr(r,0);
+   int len = buf_ptw(r);
+   buf_reset(r);
+
+   /* single frame sent as it is */
+   unsigned char *frame = NULL;
+   int flen = 0;
+   if (_cmd_record_next(head, &d[hlen], len - hlen, &frame, &flen) == len - hlen) {
+      *frame_len = flen;
+      return frame;
+   }
+
+   tunnel_cmd_data_len(d, 1, len);
+   tunnel_cmd_chann_id(d, 1, 0);
+   tunnel_cmd_chann_magic(d, 1, 0);
+   tunnel_cmd_head_cmd(d, 1, TUNNEL_CMD_RECORD);
+   *frame_len = tunnel_cmd_pack(head, d, len, &d);
+   return d;
+}
+
 int
 tunnel_cmd_data_len(unsigned char *data, int set, int data_len) {
    if (data) {
@@ -103,3 +365,20 @@ tunnel_cmd_head_cmd(unsigned char *data, int set, int cmd) {
    }
    return TUNNEL_CMD_NONE;
 }
+
+int
+tunnel_cmd_window(unsigned char *payload, int set, int window) {
+   if (payload) {
+      if (set) {
+         payload[0] = (window >> 24) & 0xff;
+         payload[1] = (window >> 16) & 0xff;
+         payload[2] = (window >> 8) & 0xff;
+         payload[3] = (window & 0xff);
+         return window;
+      }
+      else {
+         return (payload[0]<<24) | (payload[1]<<16) | (payload[2]<<8) | payload[3];
+      }
+   }
+   return -1;
+}
@@ -15,19 +15,65 @@
  * 3 bytes        | 4 bytes  |  4 bytes | 1 byte     | n bytes
  *
  * support data < 2^24 (16777216, 16M)
+ *
+ * frames are built with this classic head, then packed to compact head
+ * for link negotiated TUNNEL_AUTH_FLAG_COMPACT:
+ *
+ * [              COMPACT HEADER              ]
+ * CMD_GEN | GEN_LOW | CHANN_ID | MAGIC         | PAYLOAD
+ * 1 byte  | 1 byte  | varint   | 4 bytes or 0  | n bytes
+ *
+ * CMD_GEN high 4 bits cmd, bit 3 set for full MAGIC following, low 3
+ * bits with GEN_LOW are magic low 11 bits. varint 7 bits per byte, low
+ * bits first. length comes from link or RECORD entry, no TOTAL_DATA_LEN.
+ *
+ * classic frame first byte is 0 (length < 1M, chann_id < 16M), compact
+ * one has cmd in high 4 bits, parse tells them apart per frame
  */
 
 #define TUNNEL_CMD_CONST_HEADER_LEN 12
+#define TUNNEL_CMD_COMPACT_GEN_MASK (0x7ff) /* magic bits in compact head */
+
+enum {
+   TUNNEL_CMD_HEAD_CLASSIC = 0,
+   TUNNEL_CMD_HEAD_COMPACT,
+};
 
 #define TUNNEL_CHANN_BUF_SIZE  32768 /* 32k */
+#define TUNNEL_FRAME_MAX       (8*TUNNEL_CHANN_BUF_SIZE)  /* 256k frame limit, under 1M for head detect */
+#define TUNNEL_LINK_BUF_SIZE   (TUNNEL_FRAME_MAX + TUNNEL_CHANN_BUF_SIZE) /* link recv */
 #define TUNNEL_CHANN_MAX_COUNT (1024)
+#define TUNNEL_LINK_MAX_COUNT  (8)    /* links from one local */
+#define TUNNEL_CLIENT_MAX_COUNT (64)  /* links accepted by remote */
+
+/* send queue watermark, pause producer over high, resume under low */
+#define TUNNEL_CHANN_HIGH_MARK (8*TUNNEL_CHANN_BUF_SIZE)   /* 256k */
+#define TUNNEL_CHANN_LOW_MARK  (2*TUNNEL_CHANN_BUF_SIZE)   /* 64k */
+#define TUNNEL_LINK_HIGH_MARK  (64*TUNNEL_CHANN_BUF_SIZE)  /* 2M */
+#define TUNNEL_LINK_LOW_MARK   (16*TUNNEL_CHANN_BUF_SIZE)  /* 512k */
+#define TUNNEL_LINK_TUNE_MAX   (16*1024*1024)  /* link buffer autotune limit */
+
+/* default DATA bytes in flight per chann, under chann high mark */
+#define TUNNEL_CHANN_WINDOW    (6*TUNNEL_CHANN_BUF_SIZE)   /* 192k */
+
+/* record of small frames under one crypto pass, in legacy frame size */
+#define TUNNEL_RECORD_MAX       (TUNNEL_CHANN_BUF_SIZE - 8)
+#define TUNNEL_RECORD_FRAME_MAX (4096)  /* larger frame sent on its own */
+
+/* AUTH feature flags */
+#define TUNNEL_AUTH_FLAG_RECORD (1)     /* accepts RECORD */
+#define TUNNEL_AUTH_FLAG_LZ     (2)     /* accepts DATA_LZ */
+#define TUNNEL_AUTH_FLAG_COMPACT (4)    /* accepts compact head */
+#define TUNNEL_AUTH_FLAG_EARLY  (8)     /* accepts EARLY_DATA in CONNECT */
 
 typedef struct {
-   int data_len;
+   int data_len;                /* frame length with classic head */
    int chann_id;
    int magic;
    int cmd;
    unsigned char *payload;      /* from payload */
+   int magic_mask;              /* magic low bits only, 0 for full */
+   int head;                    /* TUNNEL_CMD_HEAD_* of frame */
 } tunnel_cmd_t;
 
 /* cmd and payload layout */
@@ -42,23 +88,32 @@ enum {
     */
 
    TUNNEL_CMD_AUTH,
-   /* REQUEST : AUTH_TYPE | USER_NAME | PASSWORD_PAYLOAD
-                1 byte    | 16 byte   | 16 bytes
+   /* REQUEST : AUTH_TYPE | USER_NAME | PASSWORD_PAYLOAD | WINDOW  | FLAGS  | FRAME
+                1 byte    | 16 byte   | 16 bytes         | 4 bytes | 1 byte | 4 bytes
 
 
-      RESPONSE: 1/0 (SUCCESS/FAIL)
-                1 byte
+      RESPONSE: 1/0 (SUCCESS/FAIL) | WINDOW  | FLAGS  | FRAME
+                1 byte             | 4 bytes | 1 byte | 4 bytes
+
+      NOTE    : WINDOW is DATA bytes the sender accepts per chann before
+                WINDOW_UPDATE, 0 for no limit. peer without WINDOW field
+                has no flow control, never send WINDOW_UPDATE to it.
+                FLAGS is TUNNEL_AUTH_FLAG_* the sender accepts, 0 when
+                missing. FRAME is largest encoded frame the sender
+                accepts, TUNNEL_CHANN_BUF_SIZE when missing
     */
 
    TUNNEL_CMD_CONNECT,
-   /* REQUEST : ADDR_TYPE | PORT_PAYLOAD | ADDR_PAYLOAD | NULL
-                1 byte    | 2 bytes      |  n bytes     | '\0'
+   /* REQUEST : ADDR_TYPE | PORT_PAYLOAD | ADDR_PAYLOAD | NULL | EARLY_DATA
+                1 byte    | 2 bytes      |  n bytes     | '\0' | n bytes
 
       RESPONSE: RESULT | PORT_PAYLOAD | ADDR_PAYLOAD
                 1 byte | 2 bytes      | 4 bytes
 
       NOTE    : ADDR_TYPE should be 0/1 (dot numberic/domain)
                 RESULT should be 0/1 (failure/success), failure will ignore ADDR and PORT
+                EARLY_DATA is client first bytes written when connected,
+                only sent to peer with TUNNEL_AUTH_FLAG_EARLY
     */
 
    TUNNEL_CMD_CLOSE,
@@ -76,6 +131,34 @@ enum {
       
       NO RESPONSE
     */
+
+   TUNNEL_CMD_WINDOW,
+   /* REQUEST : WINDOW_INCREMENT
+                4 bytes
+
+      NO RESPONSE
+      NOTE    : DATA of chann written out, peer may send that much more
+    */
+
+   TUNNEL_CMD_RECORD,
+   /* REQUEST : FRAME | FRAME | ...
+                n bytes
+
+      NO RESPONSE
+      NOTE    : plain frames packed under one encryption, chann_id and
+                magic are 0, never nested. only sent to peer with
+                TUNNEL_AUTH_FLAG_RECORD. in compact head each FRAME
+                follows its varint length
+    */
+
+   TUNNEL_CMD_DATA_LZ,
+   /* REQUEST : LZ_BLOCK
+                n bytes
+
+      NO RESPONSE
+      NOTE    : DATA payload compressed by tunnel_lz, window counts raw
+                bytes. only sent to peer with TUNNEL_AUTH_FLAG_LZ
+    */
 };
 
 enum {
@@ -84,7 +167,44 @@ enum {
    TUNNEL_ADDR_TYPE_INVALID,    /* for connection failure */
 };
 
+/* classic or compact head, frame_len is whole frame */
 int tunnel_cmd_check(buf_t *b, tunnel_cmd_t *cmd);
+int tunnel_cmd_parse(unsigned char *frame, int frame_len, tunnel_cmd_t *cmd);
+
+/* chann magic of frame, compact head may carry low bits only */
+int tunnel_cmd_magic_match(tunnel_cmd_t *cmd, int magic);
+
+/* classic frame to head in place, return frame length, *out frame start */
+int tunnel_cmd_pack(int head, unsigned char *frame, int frame_len, unsigned char **out);
+
+/* part of frame encoded on link, classic length head replaced by link's,
+   return unit start */
+unsigned char* tunnel_cmd_unit(unsigned char *frame, int *unit_len);
+
+/* decoded unit at frame[3] back to frame, classic length head restored,
+   return frame start */
+unsigned char* tunnel_cmd_unit_frame(unsigned char *frame, int *frame_len);
+
+/* frame callback, return < 0 to stop decoding */
+typedef int (*tunnel_cmd_frame_cb)(unsigned char *frame, int frame_len, void *ud);
+
+/* split complete frames received in b, call cb with each, partial frame
+   kept at buffer head for next recv. return frames count, -1 for invalid
+   frame length or cb stopped */
+int tunnel_cmd_decode(buf_t *b, tunnel_cmd_frame_cb cb, void *ud);
+
+/* call cb with each frame packed in RECORD payload of head, return
+   frames count, -1 for invalid frame or cb stopped */
+int tunnel_cmd_record_split(int head, unsigned char *payload, int payload_len,
+                            tunnel_cmd_frame_cb cb, void *ud);
+
+/* pack frame in head into record buffer r, sized up to TUNNEL_RECORD_MAX,
+   return 0 when no room */
+int tunnel_cmd_record_append(buf_t *r, int head, unsigned char *frame, int frame_len);
+
+/* finish record in r, return frame in head to encode and send, single
+   frame returned unpacked, NULL when empty. r reset before next append */
+unsigned char* tunnel_cmd_record_seal(buf_t *r, int head, int *frame_len);
 
 /* data should be buffer header */
 int tunnel_cmd_data_len(unsigned char *data, int set, int data_len);
@@ -92,4 +212,7 @@ int tunnel_cmd_chann_id(unsigned char *data, int set, int chann_id);
 int tunnel_cmd_chann_magic(unsigned char *data, int set, int magic);
 int tunnel_cmd_head_cmd(unsigned char *data, int set, int cmd);
 
+/* 4 bytes window in payload */
+int tunnel_cmd_window(unsigned char *payload, int set, int window);
+
 #endif
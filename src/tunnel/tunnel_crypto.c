@@ -20,7 +20,7 @@
 
 /* fromo cloudwu's https://github.com/cloudwu/mptun/blob/master/mptun.c */
 
-#define DEF_BUFF_SIZE TUNNEL_CHANN_BUF_SIZE
+#define DEF_BUFF_SIZE TUNNEL_FRAME_MAX
 
 #ifndef DEF_TIME_DIFF
 #define DEF_TIME_DIFF 3600
@@ -151,8 +151,9 @@ hmac(uint64_t x, uint64_t y) {
    return (uint64_t)(a^b) << 32 | (c^d);
 }
 
+/* head gets 8 bytes check, out can be in for inplace encoding */
 int
-mc_encrypt(const char *in, int sz, char *out, uint64_t key, time_t ti) {
+mc_encrypt_ex(const char *in, int sz, char *head, char *out, uint64_t key, time_t ti) {
    uint64_t h = mc_hash_key(in, sz);
    uint32_t tmp;
    struct rc4_sbox rs;
@@ -164,14 +165,19 @@ mc_encrypt(const char *in, int sz, char *out, uint64_t key, time_t ti) {
    rc4_init(&rs, key);
    key ^= h;
    tmp = htonl(ti);
-   memcpy(out, &tmp, 4);
+   memcpy(head, &tmp, 4);
    tmp = htonl((uint32_t)key ^ (uint32_t)(key >> 32));
-   memcpy(out+4, &tmp, 4);
-   rc4_encode(&rs, (const uint8_t *)in, (uint8_t *)out+8, sz);
+   memcpy(head+4, &tmp, 4);
+   rc4_encode(&rs, (const uint8_t *)in, (uint8_t *)out, sz);
 
    return sz + 8;
 }
 
+int
+mc_encrypt(const char *in, int sz, char *out, uint64_t key, time_t ti) {
+   return mc_encrypt_ex(in, sz, out, out+8, key, ti);
+}
+
 int
 mc_decrypt(const char *in, int sz, char *out, uint64_t key, time_t ti) {
    uint32_t pt, check;
@@ -11,6 +11,7 @@
 uint64_t mc_hash_key(const char * str, int sz);
 
 int mc_encrypt(const char *in, int sz, char *out, uint64_t key, time_t ti);
+int mc_encrypt_ex(const char *in, int sz, char *head, char *out, uint64_t key, time_t ti);
 int mc_decrypt(const char *in, int sz, char *out, uint64_t key, time_t ti);
 
 int mc_enc_exp(unsigned char *data, int data_len);
@@ -41,6 +41,8 @@
 #include "tunnel_dns.h"
 #include "tunnel_local.h"
 #include "tunnel_crypto.h"
+#include "tunnel_sched.h"
+#include "tunnel_lz.h"
 
 #include <assert.h>
 
@@ -56,6 +58,7 @@ typedef enum {
    LOCAL_CHANN_STATE_WAIT_LOCAL,     /* opened, need to recieve '05 01 00' */
    LOCAL_CHANN_STATE_ACCEPT,         /* connected local, send '05 00' */
    LOCAL_CHANN_STATE_DISCONNECT,     /* disconnect from remote, no need to send close */
+   LOCAL_CHANN_STATE_WAIT_EARLY,     /* replied local, wait first bytes for CONNECT */
    LOCAL_CHANN_STATE_WAIT_REMOTE,    /* wait remote connected */
    LOCAL_CHANN_STATE_CONNECTED,      /* remote connected */
 } local_chann_state_t;
@@ -67,30 +70,70 @@ typedef enum {
    LOCAL_FRONT_STATE_AUTHORIZED,
 } local_front_state_t;
 
+/* tcp link to remote, authorized on its own */
+typedef struct {
+   int idx;                     /* index in links */
+   local_front_state_t state;
+   int data_mark;
+   int chann_count;             /* channs pinned to link */
+   int over_count;              /* chann over high mark, pause tcpout */
+   int link_over;               /* tcpout over high mark, pause channs */
+   int peer_flow;               /* remote knows WINDOW_UPDATE */
+   int peer_window;             /* remote chann window, 0 no limit */
+   int peer_record;             /* remote accepts RECORD */
+   int frame_max;               /* encoded frame limit both sides accept */
+   int peer_lz;                 /* remote accepts DATA_LZ */
+   int peer_early;              /* remote accepts EARLY_DATA in CONNECT */
+   int head;                    /* TUNNEL_CMD_HEAD_* of frames sent */
+   chann_t *tcpout;             /* tcp for forward */
+   buf_t *bufout;               /* buf for forward */
+   buf_t *record;               /* small frames packed till poll round end */
+   tunnel_sched_t sched;        /* DATA frames wait for link */
+   int sched_credit;            /* bytes to link before unsent checked */
+   int sched_wait;              /* wait link SEND event */
+} tun_local_link_t;
+
 typedef struct {
    local_chann_state_t state;
    int chann_id;                /* chann id in slots  */
    int magic;                   /* unique chann magic in chann slots */
    chann_t *tcpin;              /* for input */
    buf_t *bufin;                /* buf for input */
+   int over_mark;               /* tcpin send queue over high mark */
+   time_t deadline;             /* expire time of current state */
+   time_t timer_at;             /* timer fire time */
+   mnet_timer_t *timer;
    lst_node_t *node;            /* node in active_list */
+   tun_local_link_t *link;      /* pinned link */
+   int send_window;             /* DATA bytes remote still accepts */
+   int recv_pending;            /* DATA bytes from remote not granted back */
+   int grant_wait;              /* wait tcpin drained to grant */
+   int frame_size;              /* DATA payload of next read, grows for bulk */
+   int lz_skip;                 /* DATA frames sent raw before compress again */
+   int replied;                 /* local got success before remote connected */
+   mnet_timer_t *early_timer;   /* wait first bytes for CONNECT */
+   tunnel_sched_flow_t flow;    /* frames in link sched */
 } tun_local_chann_t;
 
 typedef struct {
    int running;                 /* running status */
    time_t ti;
    uint64_t key;
-   int timer_active;
-   int data_mark;
    int chann_idx;
-   int magic_code;
    tunnel_local_mode_t mode;
-   local_front_state_t state;
    tunnel_local_config_t conf;
+   struct {
+      int handshake;
+      int connect;
+      int idle;
+   } expired;                   /* chann timeout stats */
    chann_t *tcpin;              /* tcp for listen */
-   chann_t *tcpout;             /* tcp for forward */
-   buf_t *bufout;               /* buf for forward */
+   int link_count;
+   tun_local_link_t links[TUNNEL_LINK_MAX_COUNT];
    buf_t *buftmp;               /* buf for crypto */
+   buf_t *bufbulk;              /* buf for DATA frame over chann buf */
+   buf_t *buflz;                /* buf for DATA_LZ frame or its payload */
+   tunnel_lz_t lz;              /* compress hash table */
    lst_t *active_lst;           /* active chann list */
    lst_t *free_lst;             /* free chann list */
    tun_local_chann_t *channs[TUNNEL_CHANN_MAX_COUNT];
@@ -100,11 +143,29 @@ static tun_local_t _g_local;
 
 static void _local_chann_tcpin_cb_front(chann_event_t *e);
 static void _local_tcpout_cb_front(chann_event_t *e);
+static void _local_chann_active(tun_local_chann_t *c);
 
 static inline tun_local_t* _tun_local(void) {
    return &_g_local;
 }
 
+/* description: least loaded authorized link, channs on one link share its
+ * congestion window
+ */
+static tun_local_link_t*
+_local_link_pick(tun_local_t *tun) {
+   tun_local_link_t *p = &tun->links[0];
+   for (int i=1; i<tun->link_count; i++) {
+      tun_local_link_t *l = &tun->links[i];
+      int la = (l->state == LOCAL_FRONT_STATE_AUTHORIZED);
+      int pa = (p->state == LOCAL_FRONT_STATE_AUTHORIZED);
+      if ((la && !pa) || (la==pa && l->chann_count < p->chann_count)) {
+         p = l;
+      }
+   }
+   return p;
+}
+
 /* description: chann r from local listen
  */
 static void
@@ -119,24 +180,99 @@ _local_chann_open(chann_t *r) {
       c->bufin = buf_create(TUNNEL_CHANN_BUF_SIZE);
       assert(c->bufin);
       c->chann_id = tun->chann_idx;
+      c->magic = 0;
       tun->chann_idx += 1;
+      tunnel_sched_flow_init(&c->flow, TUNNEL_SCHED_NORMAL, c);
    }
    tun->channs[c->chann_id] = c;
-   c->magic = (++tun->magic_code);
+   c->magic += 1;               /* stale frames of last use told apart */
    c->tcpin = r;
+   c->over_mark = 0;
    c->node = lst_pushl(tun->active_lst ,c);
+   if (c->flow.bytes <= 0) {
+      c->link = _local_link_pick(tun); /* else frames of last use still queued */
+   }
+   c->link->chann_count++;
+   c->send_window = c->link->peer_window;
+   c->recv_pending = 0;
+   c->grant_wait = 0;
+   c->frame_size = 0;
+   c->lz_skip = 0;
+   c->replied = 0;
+   buf_reset(c->bufin);         /* CONNECT or cached DATA of last use */
+
+   if ( c->link->link_over ) {
+      mnet_chann_active_event(c->tcpin, MNET_EVENT_RECV, 0);
+   }
+   mnet_chann_set_watermark(c->tcpin, TUNNEL_CHANN_LOW_MARK, TUNNEL_CHANN_HIGH_MARK);
 
    if (tun->mode == TUNNEL_LOCAL_MODE_FRONT) {
       c->state = LOCAL_CHANN_STATE_WAIT_LOCAL; /* wait local connect cmd */
       mnet_chann_set_cb(c->tcpin, _local_chann_tcpin_cb_front, c);
+      _local_chann_active(c);
    }
    /* _verbose("chann %d:%d open, [a:%d,f:%d]\n", c->chann_id, c->magic, */
    /*          lst_count(tun->active_lst), lst_count(tun->free_lst)); */
 }
 
+/* description: chann tcpin over high mark or not, pause tcpout reading
+ * while any chann over
+ */
+static void
+_local_chann_mark(tun_local_chann_t *c, int over) {
+   tun_local_link_t *l = c->link;
+   if (c->over_mark == over) {
+      return;
+   }
+   c->over_mark = over;
+   l->over_count += over ? 1 : -1;
+   if (l->tcpout && mnet_chann_state(l->tcpout) == CHANN_STATE_CONNECTED) {
+      if (over && l->over_count == 1) {
+         mnet_chann_active_event(l->tcpout, MNET_EVENT_RECV, 0);
+      }
+      else if (!over && l->over_count == 0) {
+         mnet_chann_active_event(l->tcpout, MNET_EVENT_RECV, 1);
+      }
+   }
+}
+
+static inline int
+_local_buf_available(buf_t *b) {
+   /* for crypto, keep least 8 bytes */
+   return (buf_available(b) - TUNNEL_CMD_CONST_HEADER_LEN);
+}
+
+/* description: tcpin reads while link under high mark and remote window
+ * left, local bytes wait in kernel till remote connected, or in bufin
+ * after optimistic reply
+ */
+static void
+_local_chann_recv_update(tun_local_chann_t *c) {
+   tun_local_link_t *l = c->link;
+   int pending = c->replied && _local_buf_available(c->bufin)>0;
+   int active = (c->state!=LOCAL_CHANN_STATE_WAIT_REMOTE || pending) &&
+      !l->link_over && (l->peer_window<=0 || c->send_window>0) &&
+      c->flow.bytes < TUNNEL_SCHED_FLOW_MAX;
+   mnet_chann_active_event(c->tcpin, MNET_EVENT_RECV, active);
+}
+
+/* description: tcpout over high mark or not, pause channs reading
+ */
+static void
+_local_link_mark(tun_local_t *tun, tun_local_link_t *l, int over) {
+   l->link_over = over;
+   lst_foreach(it, tun->active_lst) {
+      tun_local_chann_t *c = (tun_local_chann_t*)lst_iter_data(it);
+      if (c->link==l && c->state > LOCAL_CHANN_STATE_DISCONNECT) {
+         _local_chann_recv_update(c);
+      }
+   }
+}
+
 /* description: only shut down mnet socket, but keep local active */
 static void
 _local_chann_closing(tun_local_chann_t *c) {
+   _local_chann_mark(c, 0);
    if (c->state > LOCAL_CHANN_STATE_DISCONNECT) {
       /* _verbose("chann %d:%d closing %d\n", */
       /*          c->chann_id, c->magic, mnet_chann_state(c->tcpin)); */
@@ -159,9 +295,19 @@ _local_chann_close(tun_local_chann_t *c) {
 
       c->state = LOCAL_CHANN_STATE_NONE;
 
+      if (c->timer) {
+         mnet_timer_cancel(c->timer);
+         c->timer = NULL;
+      }
+      if (c->early_timer) {
+         mnet_timer_cancel(c->early_timer);
+         c->early_timer = NULL;
+      }
+
       lst_remove(tun->active_lst, c->node);
       lst_pushl(tun->free_lst, c);
 
+      c->link->chann_count--;
       c->node = NULL;
       tun->channs[c->chann_id] = NULL;
 
@@ -190,14 +336,19 @@ _local_cmd_send_accept(chann_t *n, uint8_t val) {
 }
 
 static void
-_local_cmd_fail_to_connect(chann_t *n) {
+_local_cmd_fail_to_connect(tun_local_chann_t *c) {
+   if ( c->replied ) {
+      /* success already replied, local sees reset when closed */
+      mnet_chann_setopt(c->tcpin, MNET_OPT_LINGER, 0);
+      return;
+   }
    /* fail to connect */
    uint8_t es[10] = {0x05, 0x05, 0x00, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00};
-   mnet_chann_send(n, es, 10);
+   mnet_chann_send(c->tcpin, es, 10);
 }
 
 static void
-_local_cmd_send_connected(tun_local_chann_t *c, uint8_t *addr, int port) {
+_local_cmd_send_success(chann_t *n, uint8_t *addr, int port) {
    uint8_t es[10] = {
       0x05, 0x00, 0x00, 0x01,
       addr[0], addr[1], addr[2], addr[3],
@@ -205,32 +356,236 @@ _local_cmd_send_connected(tun_local_chann_t *c, uint8_t *addr, int port) {
    };
 
    /* _print_hex(es, 10); */
-   mnet_chann_send(c->tcpin, es, 10);
+   mnet_chann_send(n, es, 10);
+}
+
+static void
+_local_cmd_send_connected(tun_local_chann_t *c, uint8_t *addr, int port) {
+   if ( !c->replied ) {
+      _local_cmd_send_success(c->tcpin, addr, port);
+   }
    c->state = LOCAL_CHANN_STATE_CONNECTED;
+   _local_chann_active(c);
+   _local_chann_recv_update(c);
 }
 
+static void _front_cmd_disconnect(tun_local_chann_t *c);
+
+/* description: timeout of chann state in seconds
+ */
 static int
-_front_send_remote_data(unsigned char *buf, int buf_len) {
+_local_chann_timeout(tun_local_t *tun, tun_local_chann_t *c) {
+   switch (c->state) {
+      case LOCAL_CHANN_STATE_WAIT_LOCAL:
+      case LOCAL_CHANN_STATE_ACCEPT:
+         return tun->conf.handshake_timeout;
+      case LOCAL_CHANN_STATE_WAIT_REMOTE:
+         return tun->conf.connect_timeout;
+      case LOCAL_CHANN_STATE_CONNECTED:
+         return tun->conf.idle_timeout;
+      default:
+         return 0;
+   }
+}
+
+static void
+_local_chann_timer_cb(mnet_timer_t *t, void *ud) {
    tun_local_t *tun = _tun_local();
+   tun_local_chann_t *c = (tun_local_chann_t*)ud;
+   time_t now = time(NULL);
+
+   if (c->deadline > now) {
+      /* deadline moved since armed */
+      c->timer_at = c->deadline;
+      mnet_timer_reset(t, (int)(c->deadline - now) * 1000);
+      return;
+   }
+
+   c->timer = NULL;             /* once timer freed after callback */
+   if (c->deadline <= 0) {
+      return;
+   }
+
+   switch (c->state) {
+      case LOCAL_CHANN_STATE_WAIT_LOCAL:
+      case LOCAL_CHANN_STATE_ACCEPT:
+         tun->expired.handshake++;
+         _verbose("chann %d:%d handshake timeout\n", c->chann_id, c->magic);
+         mnet_chann_close(c->tcpin); /* close event free chann */
+         return;
+      case LOCAL_CHANN_STATE_WAIT_REMOTE:
+         tun->expired.connect++;
+         _local_cmd_fail_to_connect(c);
+         break;
+      case LOCAL_CHANN_STATE_CONNECTED:
+         tun->expired.idle++;
+         break;
+      default:
+         return;
+   }
+   _verbose("chann %d:%d timeout in state %d\n", c->chann_id, c->magic, c->state);
+   _front_cmd_disconnect(c);
+   _local_chann_closing(c);
+}
+
+/* description: update deadline on state change or data, the timer only
+ * re-armed when fired before deadline
+ */
+static void
+_local_chann_active(tun_local_chann_t *c) {
+   tun_local_t *tun = _tun_local();
+   int timeout = _local_chann_timeout(tun, c);
+
+   if (timeout <= 0) {
+      c->deadline = 0;
+      return;
+   }
+
+   c->deadline = time(NULL) + timeout;
+   if (c->timer == NULL) {
+      c->timer = mnet_timer_add(timeout * 1000, 0, _local_chann_timer_cb, c);
+      c->timer_at = c->deadline;
+   }
+   else if (c->deadline < c->timer_at) {
+      mnet_timer_reset(c->timer, timeout * 1000);
+      c->timer_at = c->deadline;
+   }
+}
+
+/* description: encode one frame or record to link, unit is frame
+ * without classic length head
+ */
+static int
+_front_link_send(tun_local_link_t *l, unsigned char *unit, int unit_len) {
+   struct iovec iov[2];
 
 #ifdef DEF_TUNNEL_SIMPLE_CRYPTO
-   mc_enc_exp(&buf[3], buf_len-3);
-   return mnet_chann_send(tun->tcpout, buf, buf_len);
+   unsigned char head[3];
+   mc_enc_exp(unit, unit_len);
+   tunnel_cmd_data_len(head, 1, unit_len + 3);
 #else
-   char *tbuf = (char*)buf_addr(tun->buftmp,0);
+   /* encode inplace, send head and payload without staging copy */
+   tun_local_t *tun = _tun_local();
+   unsigned char head[3 + 8];
 
-   int data_len = mc_encrypt((char*)&buf[3], buf_len-3, &tbuf[3], tun->key, tun->ti);
+   int data_len = mc_encrypt_ex((char*)unit, unit_len, (char*)&head[3], (char*)unit, tun->key, tun->ti);
    assert(data_len > 0);
 
-   tunnel_cmd_data_len((unsigned char*)tbuf, 1, data_len + 3);
-   return mnet_chann_send(tun->tcpout, tbuf, data_len + 3);
+   tunnel_cmd_data_len(head, 1, data_len + 3);
 #endif
+   iov[0].iov_base = head;
+   iov[0].iov_len = sizeof(head);
+   iov[1].iov_base = unit;
+   iov[1].iov_len = unit_len;
+   return mnet_chann_sendv(l->tcpout, iov, 2);
 }
 
+/* description: send frames packed in link record
+ */
 static void
-_front_recv_remote_data(buf_t *b) {
-   char *buf = (char*)buf_addr(b,0);
-   int buf_len = buf_buffered(b);
+_local_link_flush(tun_local_link_t *l) {
+   int len = 0;
+   unsigned char *d = tunnel_cmd_record_seal(l->record, l->head, &len);
+   if (d && l->tcpout) {
+      d = tunnel_cmd_unit(d, &len);
+      _front_link_send(l, d, len);
+   }
+}
+
+/* description: frame packed in link head, small ones into link record,
+ * encoded once when record full or poll round ends
+ */
+static int
+_front_send_remote_data(tun_local_link_t *l, unsigned char *buf, int buf_len) {
+   if (l->tcpout == NULL) {
+      return -1;
+   }
+
+   int raw_len = buf_len;
+   buf_len = tunnel_cmd_pack(l->head, buf, buf_len, &buf);
+
+   if (l->peer_record && l->record && buf_len<=TUNNEL_RECORD_FRAME_MAX) {
+      if ( tunnel_cmd_record_append(l->record, l->head, buf, buf_len) ) {
+         return raw_len;
+      }
+      _local_link_flush(l);
+      if ( tunnel_cmd_record_append(l->record, l->head, buf, buf_len) ) {
+         return raw_len;
+      }
+   }
+
+   /* keep frame order */
+   _local_link_flush(l);
+   buf = tunnel_cmd_unit(buf, &buf_len);
+   int ret = _front_link_send(l, buf, buf_len);
+   return (ret > 0) ? raw_len : ret;
+}
+
+static int
+_local_sched_send(unsigned char *frame, int len, void *ud) {
+   return _front_send_remote_data((tun_local_link_t*)ud, frame, len);
+}
+
+static void
+_local_sched_drain(tunnel_sched_flow_t *f) {
+   tun_local_chann_t *c = (tun_local_chann_t*)f->ud;
+   if (c->state == LOCAL_CHANN_STATE_CONNECTED) {
+      _local_chann_recv_update(c);
+   }
+}
+
+/* description: bytes link takes before kernel unsent checked again
+ */
+static int
+_local_link_budget(tun_local_link_t *l) {
+   if (l->sched_credit<=0 && l->tcpout) {
+      l->sched_credit = _tun_local()->conf.sched_lowat - mnet_chann_unsent(l->tcpout);
+   }
+   return l->sched_credit;
+}
+
+/* description: feed link from sched while link unsent under low mark, or
+ * wait link SEND event
+ */
+static void
+_local_link_sched(tun_local_link_t *l) {
+   while (l->sched.bytes>0 && _local_link_budget(l)>0) {
+      l->sched_credit -= tunnel_sched_run(&l->sched, l->sched_credit);
+   }
+   int wait = (l->sched.bytes>0 && l->tcpout);
+   if (wait != l->sched_wait) {
+      l->sched_wait = wait;
+      mnet_chann_active_event(l->tcpout, MNET_EVENT_SEND, wait);
+   }
+}
+
+/* description: DATA straight to link when nothing queued, or queued in
+ * sched till link ready
+ */
+static void
+_local_chann_send_data(tun_local_chann_t *c, unsigned char *data, int data_len) {
+   tun_local_link_t *l = c->link;
+   if (_tun_local()->conf.sched_lowat <= 0) {
+      _front_send_remote_data(l, data, data_len);
+   }
+   else if (l->sched.bytes<=0 && _local_link_budget(l)>0) {
+      _front_send_remote_data(l, data, data_len);
+      l->sched_credit -= data_len;
+   }
+   else {
+      tunnel_sched_push(&l->sched, &c->flow, data, data_len);
+      _local_link_sched(l);
+      if (c->flow.bytes >= TUNNEL_SCHED_FLOW_MAX) {
+         _local_chann_recv_update(c);
+      }
+   }
+}
+
+/* decode frame in place, return plain frame in its head */
+static unsigned char*
+_front_recv_remote_data(unsigned char *frame, int *frame_len) {
+   char *buf = (char*)frame;
+   int buf_len = *frame_len;
 
 #ifdef DEF_TUNNEL_SIMPLE_CRYPTO
    mc_dec_exp((unsigned char*)&buf[3], buf_len-3);
@@ -242,17 +597,77 @@ _front_recv_remote_data(buf_t *b) {
    assert(data_len > 0);
 
    memcpy(&buf[3], tbuf, data_len);
-   tunnel_cmd_data_len((unsigned char*)buf, 1, data_len + 3);
-
-   buf_reset(b);
-   buf_forward_ptw(b, data_len + 3);
+   *frame_len = data_len + 3;
 #endif
+   return tunnel_cmd_unit_frame(frame, frame_len);
 }
 
+/* description: send CONNECT built in bufin, with local first bytes read
+ * after it, queued behind frames of slot's last use still in sched
+ */
+static void
+_front_cmd_connect_send(tun_local_chann_t *fc) {
+   buf_t *ib = fc->bufin;
+   int data_len = buf_buffered(ib);
+
+   tunnel_cmd_data_len(buf_addr(ib,0), 1, data_len);
+   if (fc->flow.bytes > 0) {
+      tunnel_sched_push(&fc->link->sched, &fc->flow, buf_addr(ib,0), data_len);
+      _local_link_sched(fc->link);
+   } else {
+      _front_send_remote_data(fc->link, buf_addr(ib,0), data_len);
+   }
+   buf_reset(ib);
+
+   fc->state = LOCAL_CHANN_STATE_WAIT_REMOTE;
+   _local_chann_active(fc);
+   _local_chann_recv_update(fc);
+}
+
+static void
+_local_chann_early_cb(mnet_timer_t *t, void *ud) {
+   tun_local_chann_t *c = (tun_local_chann_t*)ud;
+   c->early_timer = NULL;       /* once timer freed after callback */
+   if (c->state == LOCAL_CHANN_STATE_WAIT_EARLY) {
+      _front_cmd_connect_send(c);
+   }
+}
+
+/* description: local first bytes appended to CONNECT waiting in bufin
+ */
+static void
+_local_chann_early_recv(tun_local_chann_t *fc) {
+   buf_t *ib = fc->bufin;
+   int want = _local_buf_available(ib);
+   if (fc->link->peer_window > 0) {
+      want = _MIN_OF(want, fc->send_window);
+   }
+
+   int ret = mnet_chann_recv(fc->tcpin, buf_addr(ib,buf_ptw(ib)), want);
+   if (ret <= 0) {
+      return;
+   }
+   buf_forward_ptw(ib, ret);
+   fc->send_window -= (fc->link->peer_window > 0) ? ret : 0;
+
+   if (fc->early_timer) {
+      mnet_timer_cancel(fc->early_timer);
+      fc->early_timer = NULL;
+   }
+   _front_cmd_connect_send(fc);
+}
+
+/* description: CONNECT built in bufin, local replied and first bytes
+ * waited for when remote accepts them in CONNECT, or replied before
+ * remote connected in optimistic mode
+ */
 static void
 _front_cmd_connect(tun_local_chann_t *fc, int addr_type, char *addr, int port) {
-   uint8_t data[TUNNEL_DNS_DOMAIN_LEN + 32] = {0};
-   memset(data, 0, TUNNEL_DNS_ADDR_LEN);
+   tun_local_t *tun = _tun_local();
+   buf_t *ib = fc->bufin;
+
+   buf_reset(ib);
+   uint8_t *data = buf_addr(ib,0);
 
    int addr_offset = TUNNEL_CMD_CONST_HEADER_LEN;
    int addr_len = strlen(addr);
@@ -269,10 +684,24 @@ _front_cmd_connect(tun_local_chann_t *fc, int addr_type, char *addr, int port) {
    data[addr_offset + 2] = port & 0xff;
 
    strcpy((char*)&data[addr_offset + 3], addr);
+   buf_forward_ptw(ib, data_len);
 
-   _front_send_remote_data(data, data_len);
+   fc->flow.prio = tunnel_sched_class(tun->conf.sched_high, tun->conf.sched_low, addr, port);
 
-   fc->state = LOCAL_CHANN_STATE_WAIT_REMOTE;
+   if (tun->conf.early_data>0 && fc->link->peer_early) {
+      uint8_t any[4] = {0};
+      _local_cmd_send_success(fc->tcpin, any, 0);
+      fc->replied = 1;
+      fc->state = LOCAL_CHANN_STATE_WAIT_EARLY;
+      fc->early_timer = mnet_timer_add(tun->conf.early_data, 0, _local_chann_early_cb, fc);
+      return;
+   }
+   if ( tun->conf.optimistic_connect ) {
+      uint8_t any[4] = {0};
+      _local_cmd_send_success(fc->tcpin, any, 0);
+      fc->replied = 1;
+   }
+   _front_cmd_connect_send(fc);
 
    /* _verbose("chann %d:%d send connection request %s, %d\n", */
    /*          fc->chann_id, fc->magic, addr, port); */
@@ -292,27 +721,182 @@ _front_cmd_disconnect(tun_local_chann_t *c) {
       tunnel_cmd_head_cmd(data, 1, TUNNEL_CMD_CLOSE);
       data[head_len] = 1;
 
-      _front_send_remote_data(data, head_len + 1);
+      if (c->flow.bytes > 0) {
+         /* after DATA queued */
+         tunnel_sched_push(&c->link->sched, &c->flow, data, head_len + 1);
+      } else {
+         _front_send_remote_data(c->link, data, head_len + 1);
+      }
    }
 }
 
-static inline int
-_local_buf_available(buf_t *b) {
-   /* for crypto, keep least 8 bytes */
-   return (buf_available(b) - TUNNEL_CMD_CONST_HEADER_LEN);
+/* description: grant remote window back for DATA written out of tcpin,
+ * wait SEND event while tcpin still caching
+ */
+static void
+_local_chann_grant(tun_local_chann_t *c) {
+   tun_local_t *tun = _tun_local();
+   int window = tun->conf.chann_window;
+
+   if (window<=0 || !c->link->peer_flow) {
+      return;
+   }
+
+   int cached = mnet_chann_cached(c->tcpin);
+   int grant = c->recv_pending - cached;
+
+   if (grant > 0 && grant >= window/2) {
+      uint8_t data[32] = {0};
+      int head_len = TUNNEL_CMD_CONST_HEADER_LEN;
+
+      tunnel_cmd_data_len(data, 1, head_len + 4);
+      tunnel_cmd_chann_id(data, 1, c->chann_id);
+      tunnel_cmd_chann_magic(data, 1, c->magic);
+      tunnel_cmd_head_cmd(data, 1, TUNNEL_CMD_WINDOW);
+      tunnel_cmd_window(&data[head_len], 1, grant);
+
+      _front_send_remote_data(c->link, data, head_len + 4);
+      c->recv_pending -= grant;
+   }
+
+   int wait = (cached > 0) && (c->recv_pending >= window/2);
+   if (wait != c->grant_wait) {
+      c->grant_wait = wait;
+      mnet_chann_active_event(c->tcpin, MNET_EVENT_SEND, wait);
+   }
+}
+
+/* description: DATA payload size for next read, chann buf size for
+ * interactive chann, doubled while reads fill it, limited by link frame
+ * and half remote window
+ */
+static int
+_local_chann_frame(tun_local_chann_t *c, int base) {
+   tun_local_link_t *l = c->link;
+   int limit = l->frame_max - 8 - TUNNEL_CMD_CONST_HEADER_LEN;
+   if (l->peer_window > 0) {
+      limit = _MIN_OF(limit, l->peer_window / 2);
+   }
+   if (c->frame_size<base || c->flow.prio==TUNNEL_SCHED_HIGH) {
+      c->frame_size = base;
+   }
+   c->frame_size = _MAX_OF(base, _MIN_OF(c->frame_size, limit));
+   return c->frame_size;
 }
 
+/* description: DATA payload compressed to buflz when remote accepts and
+ * sampled entropy low, return cmd of frame in data
+ */
+static int
+_local_chann_compress(tun_local_chann_t *c, unsigned char **data, int *data_len) {
+   tun_local_t *tun = _tun_local();
+   int hlen = TUNNEL_CMD_CONST_HEADER_LEN;
+   int raw_len = *data_len - hlen;
+   unsigned char *raw = &(*data)[hlen];
+
+   if (!tun->conf.link_compress || !c->link->peer_lz || raw_len<TUNNEL_LZ_MIN_LEN) {
+      return TUNNEL_CMD_DATA;
+   }
+   if (c->lz_skip > 0) {
+      c->lz_skip--;
+      return TUNNEL_CMD_DATA;
+   }
+   if ( !tunnel_lz_worth(raw, raw_len) ) {
+      return TUNNEL_CMD_DATA;
+   }
+
+   /* worth it when 1/16 saved */
+   unsigned char *out = buf_addr(tun->buflz,0);
+   int len = tunnel_lz_compress(&tun->lz, raw, raw_len, &out[hlen], raw_len - raw_len/16);
+   if (len <= 0) {
+      c->lz_skip = TUNNEL_LZ_SKIP;
+      return TUNNEL_CMD_DATA;
+   }
+   *data = out;
+   *data_len = hlen + len;
+   return TUNNEL_CMD_DATA_LZ;
+}
+
+/* description: local bytes after optimistic reply cached in bufin till
+ * remote connected, tcpin paused when full
+ */
+static void
+_local_chann_pending_recv(tun_local_chann_t *fc) {
+   buf_t *ib = fc->bufin;
+   if (fc->replied && buf_ptw(ib)<=0) {
+      buf_forward_ptw(ib, TUNNEL_CMD_CONST_HEADER_LEN); /* for DATA head */
+   }
+
+   int want = _local_buf_available(ib);
+   if (fc->link->peer_window > 0) {
+      want = _MIN_OF(want, fc->send_window);
+   }
+   if (fc->replied && want > 0) {
+      int ret = mnet_chann_recv(fc->tcpin, buf_addr(ib,buf_ptw(ib)), want);
+      if (ret > 0) {
+         buf_forward_ptw(ib, ret);
+         fc->send_window -= (fc->link->peer_window > 0) ? ret : 0;
+      }
+   }
+   _local_chann_recv_update(fc);
+}
+
+/* description: DATA cached before remote connected, window taken when
+ * cached
+ */
+static void
+_local_chann_send_pending(tun_local_chann_t *fc) {
+   int hlen = TUNNEL_CMD_CONST_HEADER_LEN;
+   buf_t *ib = fc->bufin;
+
+   if (buf_buffered(ib) > hlen) {
+      uint8_t *data = buf_addr(ib,0);
+      int data_len = buf_buffered(ib);
+      int cmd = _local_chann_compress(fc, &data, &data_len);
+
+      tunnel_cmd_data_len(data, 1, data_len);
+      tunnel_cmd_chann_id(data, 1, fc->chann_id);
+      tunnel_cmd_chann_magic(data, 1, fc->magic);
+      tunnel_cmd_head_cmd(data, 1, cmd);
+
+      _local_chann_send_data(fc, data, data_len);
+   }
+   buf_reset(ib);
+}
 
 void
 _local_chann_tcpin_cb_front(chann_event_t *e) {
-   tun_local_t *tun = _tun_local();
    tun_local_chann_t *fc = (tun_local_chann_t*)e->opaque;
 
    if (e->event == MNET_EVENT_RECV)
    {
+      if (fc->state == LOCAL_CHANN_STATE_WAIT_EARLY) {
+         _local_chann_early_recv(fc);
+         return;
+      }
+      if (fc->state == LOCAL_CHANN_STATE_WAIT_REMOTE) {
+         _local_chann_pending_recv(fc);
+         return;
+      }
+
       int hlen = TUNNEL_CMD_CONST_HEADER_LEN;
       buf_t *ib = fc->bufin;
-      int ret = mnet_chann_recv(e->n, buf_addr(ib,hlen), _local_buf_available(ib) - hlen);
+      int base = _local_buf_available(ib) - hlen;
+      int want = base;
+      if (fc->state == LOCAL_CHANN_STATE_CONNECTED) {
+         want = _local_chann_frame(fc, base);
+         if (want > base) {
+            ib = _tun_local()->bufbulk; /* frame copied or sent before reset */
+         }
+         if (fc->link->peer_window > 0) {
+            want = _MIN_OF(want, fc->send_window);
+            if (want <= 0) {
+               _local_chann_recv_update(fc);
+               return;
+            }
+         }
+      }
+      int ret = mnet_chann_recv(e->n, buf_addr(ib,hlen), want);
       if (ret <= 0) {
          return;
       }
@@ -320,15 +904,31 @@ _local_chann_tcpin_cb_front(chann_event_t *e) {
 
       if (fc->state == LOCAL_CHANN_STATE_CONNECTED)
       {
+         /* source has more for full read, short read back to small */
+         if (ret >= fc->frame_size) {
+            fc->frame_size *= 2;
+         } else if (ret < _MIN_OF(base, want)) {
+            fc->frame_size = base;
+         }
+
          uint8_t *data = buf_addr(ib,0);
          int data_len = buf_buffered(ib);
+         int cmd = _local_chann_compress(fc, &data, &data_len);
 
          tunnel_cmd_data_len(data, 1, data_len);
          tunnel_cmd_chann_id(data, 1, fc->chann_id);
          tunnel_cmd_chann_magic(data, 1, fc->magic);
-         tunnel_cmd_head_cmd(data, 1, TUNNEL_CMD_DATA);
+         tunnel_cmd_head_cmd(data, 1, cmd);
 
-         _front_send_remote_data(data, data_len);
+         _local_chann_send_data(fc, data, data_len);
+         _local_chann_active(fc);
+
+         if (fc->link->peer_window > 0) {
+            fc->send_window -= ret;
+            if (fc->send_window <= 0) {
+               _local_chann_recv_update(fc);
+            }
+         }
       }
       else if (fc->state == LOCAL_CHANN_STATE_WAIT_LOCAL) 
       {
@@ -336,9 +936,10 @@ _local_chann_tcpin_cb_front(chann_event_t *e) {
             uint8_t rs[3] = {0x05, 0x01, 0x00};
             if ( _hex_equal(buf_addr(ib,hlen), buf_buffered(ib)-hlen, rs, 3) ) {
 
-               if (tun->state == LOCAL_FRONT_STATE_AUTHORIZED) {
+               if (fc->link->state == LOCAL_FRONT_STATE_AUTHORIZED) {
                   //_verbose("(in) accept %p, %d\n", e->n, lst_count(tun->active_lst));
                   fc->state = LOCAL_CHANN_STATE_ACCEPT;
+                  _local_chann_active(fc);
                   _local_cmd_send_accept(e->n, 0);
                }
                else {
@@ -382,6 +983,7 @@ _local_chann_tcpin_cb_front(chann_event_t *e) {
                else {
                   assert(0);
                }
+               return;          /* bufin keeps CONNECT */
             }
          }
          else {
@@ -391,6 +993,15 @@ _local_chann_tcpin_cb_front(chann_event_t *e) {
 
       buf_reset(ib);
    }
+   else if (e->event == MNET_EVENT_SEND) {
+      _local_chann_grant(fc);
+   }
+   else if (e->event == MNET_EVENT_SEND_HIGH) {
+      _local_chann_mark(fc, 1);
+   }
+   else if (e->event == MNET_EVENT_SEND_LOW) {
+      _local_chann_mark(fc, 0);
+   }
    else if (e->event == MNET_EVENT_DISCONNECT) {
       _front_cmd_disconnect(fc);
       _local_chann_closing(fc);
@@ -406,7 +1017,7 @@ _local_chann_of_cmd(tun_local_t *tun, tunnel_cmd_t *tcmd) {
    if (tcmd) {
       if (tcmd->chann_id>=0 && tcmd->chann_id<TUNNEL_CHANN_MAX_COUNT) {
          tun_local_chann_t *c = tun->channs[tcmd->chann_id];
-         if (c && (c->magic == tcmd->magic)) {
+         if (c && tunnel_cmd_magic_match(tcmd, c->magic)) {
             return c;
          }
       }
@@ -414,146 +1025,272 @@ _local_chann_of_cmd(tun_local_t *tun, tunnel_cmd_t *tcmd) {
    return NULL;
 }
 
+/* description: auth request, with fast open queued right after connect
+ * to ride in SYN
+ */
 static void
-_local_tcpout_cb_front(chann_event_t *e) {
-   tun_local_t *tun = _tun_local();
+_front_send_auth(tun_local_t *tun, tun_local_link_t *l) {
+   unsigned char data[64] = {0};
+   memset(data, 0, sizeof(data));
 
+   int head_len = TUNNEL_CMD_CONST_HEADER_LEN;
+   unsigned short data_len = head_len + 1 + 16 + 16 + 4 + 1 + 4;
 
-   if (e->event == MNET_EVENT_RECV) {
-      tunnel_cmd_t tcmd = {0, 0, 0, 0, NULL};
-
-      int i = 0;
-      for (; i<TUNNEL_CHANN_BUF_SIZE; i+=TUNNEL_CMD_CONST_HEADER_LEN) {
-         int ret = 0;
-         buf_t *ob = tun->bufout;
-
-         if (buf_buffered(ob) < TUNNEL_CMD_CONST_HEADER_LEN) {
-            ret = mnet_chann_recv(e->n, buf_addr(ob,buf_ptw(ob)), TUNNEL_CMD_CONST_HEADER_LEN - buf_buffered(ob));
-         } else {
-            tunnel_cmd_check(ob, &tcmd);
-            ret = mnet_chann_recv(e->n, buf_addr(ob,buf_ptw(ob)), tcmd.data_len - buf_buffered(ob));
-         }
+   tunnel_cmd_data_len(data, 1, data_len);
+   tunnel_cmd_chann_id(data, 1, 0);
+   tunnel_cmd_chann_magic(data, 1, 0);
+   tunnel_cmd_head_cmd(data, 1, TUNNEL_CMD_AUTH);
 
-         if (ret <= 0) {
-            return;
-         }
-         buf_forward_ptw(ob, ret);
+   /* auth type */
+   data[head_len] = 1;
 
-         if (buf_buffered(ob) <= TUNNEL_CMD_CONST_HEADER_LEN) {
-            continue;
-         }
-         if (tcmd.data_len != buf_buffered(ob)) {
-            return;
-         }
+   /* user name */
+   int uname_base = head_len + 1;
+   strncpy((char*)&data[uname_base], tun->conf.username, 16);
 
-         /* decode data */
-         _front_recv_remote_data(ob);
+   /* user password */
+   int passw_base = uname_base + 16;
+   strncpy((char*)&data[passw_base], tun->conf.password, 16);
 
-         //_verbose("%d, %d\n", want_length, buf_buffered(ob));
-         tunnel_cmd_check(ob, &tcmd);
-         if (tcmd.cmd<=TUNNEL_CMD_NONE || tcmd.cmd>TUNNEL_CMD_DATA) {
-            assert(0);
-         }
+   /* chann window remote may send */
+   tunnel_cmd_window(&data[passw_base + 16], 1, tun->conf.chann_window);
 
-         if (tcmd.cmd == TUNNEL_CMD_ECHO) {
-            _verbose("receive echo, reset buffer !\n");
-            goto reset_buffer;
-         }
+   /* features and frame limit accepted */
+   data[passw_base + 16 + 4] = TUNNEL_AUTH_FLAG_RECORD | TUNNEL_AUTH_FLAG_LZ | TUNNEL_AUTH_FLAG_COMPACT |
+      TUNNEL_AUTH_FLAG_EARLY;
+   tunnel_cmd_window(&data[passw_base + 16 + 4 + 1], 1, tun->conf.frame_max);
 
-         tun->data_mark++;
+   _front_send_remote_data(l, data, data_len);
+}
 
-         if (tun->state == LOCAL_FRONT_STATE_AUTHORIZED) {
-         
-            tun_local_chann_t *fc = _local_chann_of_cmd(tun, &tcmd);
+/* description: one plain frame from remote
+ */
+static int
+_local_link_cmd(unsigned char *frame, int frame_len, void *ud) {
+   tun_local_t *tun = _tun_local();
+   tun_local_link_t *l = (tun_local_link_t*)ud;
+   tunnel_cmd_t tcmd = {0, 0, 0, 0, NULL, 0, 0};
 
-            if (fc) {
-               if (tcmd.cmd == TUNNEL_CMD_DATA)
-               {
-                  if (fc->state == LOCAL_CHANN_STATE_CONNECTED) {
-                     int data_len = tcmd.data_len - TUNNEL_CMD_CONST_HEADER_LEN;
-                     mnet_chann_send(fc->tcpin, tcmd.payload, data_len);
-                  }
-               }
-               else if (tcmd.cmd == TUNNEL_CMD_CONNECT)
-               {
-                  if (fc->state == LOCAL_CHANN_STATE_WAIT_REMOTE) {
-                     if (tcmd.payload[0] == 1) {
-                        int port = (tcmd.payload[1]<<8) | tcmd.payload[2];
-                        unsigned char *d = &tcmd.payload[3];
-
-                        _local_cmd_send_connected(fc, d, port);
-
-                        char addr[TUNNEL_DNS_ADDR_LEN] = {0};
-                        sprintf(addr, "%d.%d.%d.%d", d[0], d[1], d[2], d[3]);
-                        
-                        _verbose("chann %d:%d connected %s:%d\n",
-                                 tcmd.chann_id, tcmd.magic, addr, port);
-                     }
-                     else {
-                        _local_cmd_fail_to_connect(fc->tcpin);
-                     }
-                  }
-                  else {
-                     _err("chann %d err state %d\n", tcmd.chann_id, fc->state);
+   tunnel_cmd_parse(frame, frame_len, &tcmd);
+   if (tcmd.cmd<=TUNNEL_CMD_NONE || tcmd.cmd==TUNNEL_CMD_RECORD ||
+       tcmd.cmd>TUNNEL_CMD_DATA_LZ)
+   {
+      _err("link %d invalid cmd %d\n", l->idx, tcmd.cmd);
+      return -1;
+   }
+
+   if (tcmd.cmd == TUNNEL_CMD_ECHO) {
+      _verbose("receive echo, reset buffer !\n");
+      return 0;
+   }
+
+   l->data_mark++;
+
+   if (l->state == LOCAL_FRONT_STATE_AUTHORIZED) {
+
+      tun_local_chann_t *fc = _local_chann_of_cmd(tun, &tcmd);
+
+      if (fc && fc->link==l) {
+         if (tcmd.cmd==TUNNEL_CMD_DATA || tcmd.cmd==TUNNEL_CMD_DATA_LZ)
+         {
+            if (fc->state == LOCAL_CHANN_STATE_CONNECTED) {
+               unsigned char *payload = tcmd.payload;
+               int data_len = tcmd.data_len - TUNNEL_CMD_CONST_HEADER_LEN;
+               if (tcmd.cmd == TUNNEL_CMD_DATA_LZ) {
+                  payload = buf_addr(tun->buflz,0);
+                  data_len = tunnel_lz_decompress(tcmd.payload, data_len, payload, buf_len(tun->buflz));
+                  if (data_len < 0) {
+                     _err("link %d chann %d invalid lz block\n", l->idx, fc->chann_id);
+                     return -1;
                   }
                }
-               else if (tcmd.cmd == TUNNEL_CMD_CLOSE)
-               {
-                  //_verbose("chann %d close cmd %d\n", tcmd.chann_id, tcmd.payload[0]);
-                  _local_chann_closing(fc);
+               mnet_chann_send(fc->tcpin, payload, data_len);
+               _local_chann_active(fc);
+               fc->recv_pending += data_len;
+               _local_chann_grant(fc);
+            }
+         }
+         else if (tcmd.cmd == TUNNEL_CMD_WINDOW)
+         {
+            fc->send_window += tunnel_cmd_window(tcmd.payload, 0, 0);
+            if (fc->state == LOCAL_CHANN_STATE_CONNECTED) {
+               _local_chann_recv_update(fc);
+            }
+         }
+         else if (tcmd.cmd == TUNNEL_CMD_CONNECT)
+         {
+            if (fc->state == LOCAL_CHANN_STATE_WAIT_REMOTE) {
+               if (tcmd.payload[0] == 1) {
+                  int port = (tcmd.payload[1]<<8) | tcmd.payload[2];
+                  unsigned char *d = &tcmd.payload[3];
+
+                  _local_chann_send_pending(fc);
+                  _local_cmd_send_connected(fc, d, port);
+
+                  char addr[TUNNEL_DNS_ADDR_LEN] = {0};
+                  sprintf(addr, "%d.%d.%d.%d", d[0], d[1], d[2], d[3]);
+
+                  _verbose("chann %d:%d connected %s:%d\n",
+                           tcmd.chann_id, tcmd.magic, addr, port);
                }
                else {
-                  _err("chann %d err cmd %d\n", tcmd.chann_id, tcmd.cmd);
+                  _local_cmd_fail_to_connect(fc);
+                  if ( fc->replied ) {
+                     _local_chann_closing(fc);
+                  }
                }
             }
+            else {
+               _err("chann %d err state %d\n", tcmd.chann_id, fc->state);
+            }
          }
-         else if (tun->state == LOCAL_FRONT_STATE_CONNECTED) {
-            if (tcmd.cmd == TUNNEL_CMD_AUTH) {
-               if (tcmd.payload[0] == 1) {
-                  tun->state = LOCAL_FRONT_STATE_AUTHORIZED;
-               }
-               _verbose("(front) got authority value %d\n", tcmd.payload[0]);
+         else if (tcmd.cmd == TUNNEL_CMD_CLOSE)
+         {
+            //_verbose("chann %d close cmd %d\n", tcmd.chann_id, tcmd.payload[0]);
+            _local_chann_closing(fc);
+         }
+         else {
+            _err("chann %d err cmd %d\n", tcmd.chann_id, tcmd.cmd);
+         }
+      }
+   }
+   else if (l->state == LOCAL_FRONT_STATE_CONNECTED) {
+      if (tcmd.cmd == TUNNEL_CMD_AUTH) {
+         if (tcmd.payload[0] == 1) {
+            l->state = LOCAL_FRONT_STATE_AUTHORIZED;
+         }
+         if (tcmd.data_len >= TUNNEL_CMD_CONST_HEADER_LEN + 1 + 4) {
+            l->peer_flow = 1;
+            l->peer_window = tunnel_cmd_window(&tcmd.payload[1], 0, 0);
+         }
+         if (tcmd.data_len >= TUNNEL_CMD_CONST_HEADER_LEN + 1 + 4 + 1) {
+            l->peer_record = (tcmd.payload[5] & TUNNEL_AUTH_FLAG_RECORD) != 0;
+            l->peer_lz = (tcmd.payload[5] & TUNNEL_AUTH_FLAG_LZ) != 0;
+            l->peer_early = (tcmd.payload[5] & TUNNEL_AUTH_FLAG_EARLY) != 0;
+            if (tun->conf.link_compact && (tcmd.payload[5] & TUNNEL_AUTH_FLAG_COMPACT)) {
+               l->head = TUNNEL_CMD_HEAD_COMPACT;
             }
          }
-        reset_buffer:
-         buf_reset(ob);
+         if (tcmd.data_len >= TUNNEL_CMD_CONST_HEADER_LEN + 1 + 4 + 1 + 4) {
+            int frame = tunnel_cmd_window(&tcmd.payload[6], 0, 0);
+            l->frame_max = _MAX_OF(_MIN_OF(frame, tun->conf.frame_max), TUNNEL_CHANN_BUF_SIZE);
+         }
+         _verbose("(front) link %d got authority value %d\n", l->idx, tcmd.payload[0]);
       }
-      assert(i < TUNNEL_CHANN_BUF_SIZE);
    }
-   else if (e->event == MNET_EVENT_CONNECT) {
-      unsigned char data[64] = {0};
-      memset(data, 0, sizeof(data));
+   return 0;
+}
 
-      int head_len = TUNNEL_CMD_CONST_HEADER_LEN;
-      unsigned short data_len = head_len + 1 + 16 + 16;
+/* description: one frame from remote, decoded in link buffer, RECORD
+ * unpacked to frames
+ */
+static int
+_local_link_frame(unsigned char *frame, int frame_len, void *ud) {
+   tunnel_cmd_t tcmd = {0, 0, 0, 0, NULL, 0, 0};
 
-      tunnel_cmd_data_len(data, 1, data_len);
-      tunnel_cmd_chann_id(data, 1, 0);
-      tunnel_cmd_chann_magic(data, 1, 0);
-      tunnel_cmd_head_cmd(data, 1, TUNNEL_CMD_AUTH);
+   frame = _front_recv_remote_data(frame, &frame_len);
+   if ( !tunnel_cmd_parse(frame, frame_len, &tcmd) ) {
+      _err("link %d invalid frame length %d\n", ((tun_local_link_t*)ud)->idx, frame_len);
+      return -1;
+   }
 
-      /* auth type */
-      data[head_len] = 1;
+   if (tcmd.cmd == TUNNEL_CMD_RECORD) {
+      int ret = tunnel_cmd_record_split(tcmd.head, tcmd.payload,
+                                        tcmd.data_len - TUNNEL_CMD_CONST_HEADER_LEN,
+                                        _local_link_cmd, ud);
+      return (ret < 0) ? -1 : 0;
+   }
+   return _local_link_cmd(frame, frame_len, ud);
+}
 
-      /* user name */
-      int uname_base = head_len + 1;
-      strncpy((char*)&data[uname_base], tun->conf.username, 16);
+/* description: link gone, close channs pinned to it
+ */
+static void
+_local_link_closed(tun_local_t *tun, tun_local_link_t *l) {
+   l->state = LOCAL_FRONT_STATE_NONE;
+   l->link_over = 0;
+   l->peer_flow = 0;
+   l->peer_window = 0;
+   l->peer_record = 0;
+   l->peer_lz = 0;
+   l->peer_early = 0;
+   l->head = TUNNEL_CMD_HEAD_CLASSIC;
+   l->frame_max = TUNNEL_CHANN_BUF_SIZE;
+   l->sched_credit = 0;
+   l->sched_wait = 0;
+   tunnel_sched_clear(&l->sched);
+   l->tcpout = NULL;            /* destroyed after close event */
+   buf_reset(l->bufout);
+   if (l->record) {
+      buf_reset(l->record);
+   }
+   lst_foreach(it, tun->active_lst) {
+      tun_local_chann_t *c = (tun_local_chann_t*)lst_iter_data(it);
+      if (c->link == l) {
+         _local_chann_closing(c);
+      }
+   }
+}
 
-      /* user password */
-      int passw_base = uname_base + 16;
-      strncpy((char*)&data[passw_base], tun->conf.password, 16);
+static void
+_local_tcpout_cb_front(chann_event_t *e) {
+   tun_local_t *tun = _tun_local();
+   tun_local_link_t *l = (tun_local_link_t*)e->opaque;
 
-      _front_send_remote_data(data, data_len);
+   if (e->event == MNET_EVENT_RECV) {
+      /* fill link buffer, then dispatch every complete frame, mnet repeats
+         RECV till drained or quantum */
+      buf_t *ob = l->bufout;
+      int ret = mnet_chann_recv(e->n, buf_addr(ob,buf_ptw(ob)), buf_available(ob));
+      if (ret <= 0) {
+         return;
+      }
+      buf_forward_ptw(ob, ret);
 
-      _verbose("(front) connected, send auth request\n");
-      tun->state = LOCAL_FRONT_STATE_CONNECTED;
+      if (tunnel_cmd_decode(ob, _local_link_frame, l) < 0) {
+         _err("(front) link %d invalid frame from remote, close\n", l->idx);
+         mnet_chann_close(e->n);
+         _local_link_closed(tun, l);
+      }
    }
-   else if (e->event == MNET_EVENT_CLOSE) {
-      tun->state = LOCAL_FRONT_STATE_NONE;
-      lst_foreach(it, tun->active_lst) {
-         tun_local_chann_t *c = (tun_local_chann_t*)lst_iter_data(it);
-         _local_chann_closing(c);
+   else if (e->event == MNET_EVENT_SEND) {
+      l->sched_credit = 0;      /* unsent under low mark */
+      _local_link_sched(l);
+   }
+   else if (e->event == MNET_EVENT_SEND_HIGH) {
+      _verbose("(front) link over high mark, pause channs\n");
+      _local_link_mark(tun, l, 1);
+   }
+   else if (e->event == MNET_EVENT_SEND_LOW) {
+      _local_link_mark(tun, l, 0);
+   }
+   else if (e->event == MNET_EVENT_CONNECT) {
+      if ( !tun->conf.fastopen ) {
+         _front_send_auth(tun, l);
       }
+      _verbose("(front) link %d connected, send auth request\n", l->idx);
+      l->state = LOCAL_FRONT_STATE_CONNECTED;
+   }
+   else if (e->event == MNET_EVENT_CLOSE) {
+      _local_link_closed(tun, l);
+   }
+}
+
+static void
+_local_link_setopt(chann_t *n, tunnel_local_config_t *conf) {
+   if (conf->link_buffer < 0) {
+      mnet_chann_setopt(n, MNET_OPT_AUTOTUNE, TUNNEL_LINK_TUNE_MAX);
+   } else if (conf->link_buffer > 0) {
+      mnet_chann_setopt(n, MNET_OPT_SNDBUF, conf->link_buffer);
+      mnet_chann_setopt(n, MNET_OPT_RCVBUF, conf->link_buffer);
+   }
+   mnet_chann_setopt(n, MNET_OPT_NODELAY, conf->link_nodelay);
+   mnet_chann_set_cork(n, conf->link_cork);
+   if (conf->sched_lowat > 0) {
+      mnet_chann_setopt(n, MNET_OPT_NOTSENT_LOWAT, conf->sched_lowat);
+   }
+   if ( conf->fastopen ) {
+      mnet_chann_setopt(n, MNET_OPT_FASTOPEN, 1);
    }
 }
 
@@ -561,7 +1298,7 @@ static void
 _local_listen_cb(chann_event_t *e) {
    if (e->event == MNET_EVENT_ACCEPT) {
       tun_local_t *tun = _tun_local();
-      if (tun->chann_idx < TUNNEL_CHANN_MAX_COUNT) {
+      if (lst_count(tun->free_lst)>0 || tun->chann_idx<TUNNEL_CHANN_MAX_COUNT) {
          _local_chann_open(e->r);
       }
       else {
@@ -580,26 +1317,53 @@ tunnel_local_open(tunnel_local_config_t *conf) {
       memset(tun, 0, sizeof(*tun));
 
       tun->conf = *conf;
+      tun->key = mc_hash_key(conf->password, strlen(conf->password));
+      tun->ti = time(NULL);     /* auth may be encoded before poll */
       tun->active_lst = lst_create();
       tun->free_lst = lst_create();
 
       tun->tcpin = mnet_chann_open(CHANN_TYPE_STREAM);
       mnet_chann_set_cb(tun->tcpin, _local_listen_cb, tun);
-      mnet_chann_listen_ex(tun->tcpin, conf->local_ipaddr, conf->local_port, 1);
+      if ( conf->fastopen ) {
+         mnet_chann_setopt(tun->tcpin, MNET_OPT_FASTOPEN, conf->backlog);
+      }
+      mnet_chann_listen_ex(tun->tcpin, conf->local_ipaddr, conf->local_port, conf->backlog);
 
       if (conf->mode == TUNNEL_LOCAL_MODE_FRONT) {
-         tun->bufout = buf_create(TUNNEL_CHANN_BUF_SIZE);
-         tun->buftmp = buf_create(TUNNEL_CHANN_BUF_SIZE);
-         assert(tun->bufout && tun->buftmp);
-         tun->tcpout = mnet_chann_open(CHANN_TYPE_STREAM);
-         mnet_chann_set_cb(tun->tcpout, _local_tcpout_cb_front, tun);
-         mnet_chann_connect(tun->tcpout, conf->remote_ipaddr, conf->remote_port);
+         tun->buftmp = buf_create(TUNNEL_FRAME_MAX);
+         assert(tun->buftmp);
+         tun->bufbulk = buf_create(TUNNEL_FRAME_MAX);
+         assert(tun->bufbulk);
+         tun->buflz = buf_create(TUNNEL_FRAME_MAX);
+         assert(tun->buflz);
+
+         tun->link_count = _MIN_OF(_MAX_OF(conf->links, 1), TUNNEL_LINK_MAX_COUNT);
+         for (int i=0; i<tun->link_count; i++) {
+            tun_local_link_t *l = &tun->links[i];
+            l->idx = i;
+            l->frame_max = TUNNEL_CHANN_BUF_SIZE;
+            tunnel_sched_init(&l->sched, _local_sched_send, _local_sched_drain, l);
+            l->bufout = buf_create(TUNNEL_LINK_BUF_SIZE);
+            assert(l->bufout);
+            if (conf->link_record > 0) {
+               l->record = buf_create(_MIN_OF(conf->link_record, TUNNEL_RECORD_MAX));
+               assert(l->record);
+            }
+            l->tcpout = mnet_chann_open(CHANN_TYPE_STREAM);
+            mnet_chann_set_cb(l->tcpout, _local_tcpout_cb_front, l);
+            mnet_chann_set_watermark(l->tcpout, TUNNEL_LINK_LOW_MARK, TUNNEL_LINK_HIGH_MARK);
+            _local_link_setopt(l->tcpout, conf);
+            mnet_chann_connect(l->tcpout, conf->remote_ipaddr, conf->remote_port);
+            if ( conf->fastopen ) {
+               _front_send_auth(tun, l);
+            }
+         }
       }
 
       tun->mode = conf->mode;
       tun->running = 1;
 
-      _info("local open mode %d\n", tun->mode);
+      _info("local open mode %d, links %d\n", tun->mode, tun->link_count);
       _info("local listen on %s:%d\n", conf->local_ipaddr, conf->local_port);
       _info("\n");
 
@@ -640,7 +1404,7 @@ _local_update_ti() {
 }
 
 static void
-_local_send_echo(tun_local_t *tun) {
+_local_send_echo(tun_local_t *tun, tun_local_link_t *l) {
    unsigned char data[32] = {0};
    int data_len = TUNNEL_CMD_CONST_HEADER_LEN + 1;
 
@@ -652,38 +1416,39 @@ _local_send_echo(tun_local_t *tun) {
    tunnel_cmd_head_cmd(data, 1, TUNNEL_CMD_ECHO);
    data[data_len - 1] = 1;
 
-   _front_send_remote_data(data, data_len);
+   _front_send_remote_data(l, data, data_len);
    _local_update_ti();
 
-   _verbose("send echo\n");
+   _verbose("link %d send echo\n", l->idx);
 }
 
+/* description: keep alive and report every 15 s
+ */
 static void
-_local_sig_timer(int sig) {
-   tun_local_t *tun = _tun_local();
-   tun->timer_active = 1;
-}
+_local_timer_cb(mnet_timer_t *t, void *ud) {
+   tun_local_t *tun = (tun_local_t*)ud;
 
-#ifndef _WIN32
-static int
-_local_install_sig_timer() {
-   struct itimerval tick;
-   tick.it_value.tv_sec = 15;
-   tick.it_value.tv_usec = 0;
-   tick.it_interval.tv_sec = 15; /* 15 s */
-   tick.it_interval.tv_usec = 0;
-   if (signal(SIGALRM, _local_sig_timer) == SIG_ERR) {
-      fprintf(stderr, "Fail to install signal\n");
-      return 0;
-   }
+   _local_update_ti();
 
-   if (setitimer(ITIMER_REAL, &tick, NULL) != 0) {
-      fprintf(stderr, "Fail to set timer\n");
-      return 0;
+   for (int i=0; i<tun->link_count; i++) {
+      tun_local_link_t *l = &tun->links[i];
+      if (l->tcpout && l->data_mark<=0) {
+         _local_send_echo(tun, l);
+      }
+      l->data_mark = 0;
    }
-   return 1;
+
+   mm_report(1);
+   _verbose("chann count %d, timeout handshake %d, connect %d, idle %d\n",
+            mnet_report(0), tun->expired.handshake, tun->expired.connect,
+            tun->expired.idle);
+}
+
+static int
+_local_conf_int(conf_t *cf, const char *key, int def) {
+   str_t *value = utils_conf_value(cf, key);
+   return value ? atoi(str_cstr(value)) : def;
 }
-#endif
 
 static void
 _local_conf_get_values(tunnel_local_config_t *conf, char *argv[]) {
@@ -728,6 +1493,55 @@ _local_conf_get_values(tunnel_local_config_t *conf, char *argv[]) {
       strncpy(conf->password, str_cstr(value), _MIN_OF(str_len(value), 32));
    }
 
+   value = utils_conf_value(cf, "NET_ENGINE");
+   if (str_cmp(value, "SELECT", 0) == 0) {
+      conf->engine = MNET_ENGINE_SELECT;
+   } else if (str_cmp(value, "EPOLL", 0) == 0) {
+      conf->engine = MNET_ENGINE_EPOLL;
+   } else if (str_cmp(value, "IOURING", 0) == 0) {
+      conf->engine = MNET_ENGINE_IOURING;
+   }
+
+   conf->connect_timeout = _local_conf_int(cf, "CONNECT_TIMEOUT", 15);
+   conf->handshake_timeout = _local_conf_int(cf, "HANDSHAKE_TIMEOUT", 10);
+   conf->idle_timeout = _local_conf_int(cf, "IDLE_TIMEOUT", 600);
+   conf->backlog = _local_conf_int(cf, "LOCAL_BACKLOG", 128);
+
+   value = utils_conf_value(cf, "LINK_BUFFER");
+   if (value == NULL) {
+      conf->link_buffer = 0;
+   } else if (str_cmp(value, "AUTO", 0) == 0) {
+      conf->link_buffer = -1;
+   } else {
+      conf->link_buffer = atoi(str_cstr(value));
+   }
+   conf->link_nodelay = _local_conf_int(cf, "LINK_NODELAY", 1);
+   conf->link_cork = _local_conf_int(cf, "LINK_CORK", 64*1024);
+   conf->link_record = _local_conf_int(cf, "LINK_RECORD", TUNNEL_RECORD_MAX);
+   conf->link_compress = _local_conf_int(cf, "LINK_COMPRESS", 0);
+   conf->link_compact = _local_conf_int(cf, "LINK_COMPACT", 1);
+   conf->early_data = _local_conf_int(cf, "EARLY_DATA", 0);
+   conf->optimistic_connect = _local_conf_int(cf, "OPTIMISTIC_CONNECT", 0);
+   conf->links = _local_conf_int(cf, "TUNNEL_LINKS", 1);
+   conf->chann_window = _local_conf_int(cf, "CHANN_WINDOW", TUNNEL_CHANN_WINDOW);
+   conf->frame_max = _local_conf_int(cf, "FRAME_MAX", TUNNEL_FRAME_MAX);
+   conf->frame_max = _MAX_OF(_MIN_OF(conf->frame_max, TUNNEL_FRAME_MAX), TUNNEL_CHANN_BUF_SIZE);
+   conf->sched_lowat = _local_conf_int(cf, "SCHED_LOWAT", 128*1024);
+
+   value = utils_conf_value(cf, "SCHED_HIGH");
+   if (value) {
+      strncpy(conf->sched_high, str_cstr(value), _MIN_OF(str_len(value), 127));
+   } else {
+      strcpy(conf->sched_high, "22,23,3389");
+   }
+   value = utils_conf_value(cf, "SCHED_LOW");
+   if (value) {
+      strncpy(conf->sched_low, str_cstr(value), _MIN_OF(str_len(value), 127));
+   }
+   conf->fastopen = _local_conf_int(cf, "FASTOPEN", 0);
+   conf->recv_budget = _local_conf_int(cf, "RECV_BUDGET", 1024*1024);
+   conf->recv_quantum = _local_conf_int(cf, "RECV_QUANTUM", 64*1024);
+
    value = utils_conf_value(cf, "RUN_DAEMON");
    if (str_cmp(value, "YES", 0) == 0) {
       //daemon(1, 0);
@@ -751,11 +1565,6 @@ main(int argc, char *argv[]) {
 
 #ifndef _WIN32
    signal(SIGPIPE, SIG_IGN);
-
-   if (_local_install_sig_timer() <= 0) {
-      fprintf(stderr, "[local] fail to install sig timer !\n");
-      return 0;
-   }
 #endif
 
    tunnel_local_config_t conf = {TUNNEL_LOCAL_MODE_INVALID,0,0, "", ""};
@@ -764,12 +1573,13 @@ main(int argc, char *argv[]) {
 
    if (conf.mode == TUNNEL_LOCAL_MODE_FRONT)
    {
-      mnet_init();
+      mnet_init_ex(conf.engine);
+      mnet_set_recv_budget(conf.recv_budget, conf.recv_quantum);
 
       if (tunnel_local_open(&conf) > 0) {
          tun_local_t *tun = _tun_local();
 
-         tun->key = mc_hash_key(conf.password, strlen(conf.password));
+         mnet_timer_add(15000, 15000, _local_timer_cb, tun); /* 15 s */
 
          for (int i=0;;i++) {
 
@@ -781,16 +1591,9 @@ main(int argc, char *argv[]) {
             _local_update_ti();
             mnet_poll( -1 );
 
-            if (tun->timer_active && tun->mode==TUNNEL_LOCAL_MODE_FRONT) {
-               tun->timer_active = 0;
-
-               if (tun->data_mark <= 0) {
-                  _local_send_echo(tun);
-               }
-               tun->data_mark = 0;
-
-               mm_report(1);
-               _verbose("chann count %d\n", mnet_report(0));
+            /* frames packed in this round */
+            for (int j=0; j<tun->link_count; j++) {
+               _local_link_flush(&tun->links[j]);
             }
          }
 
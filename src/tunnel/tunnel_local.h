@@ -24,6 +24,28 @@ typedef struct {
    char remote_ipaddr[16];
    char username[32];
    char password[32];
+   int engine;                  /* mnet engine */
+   int connect_timeout;         /* in seconds, 0 to disable */
+   int handshake_timeout;
+   int idle_timeout;
+   int backlog;                 /* listen backlog */
+   int link_buffer;             /* bytes, 0 kernel default, -1 autotune */
+   int link_nodelay;
+   int link_cork;               /* batch link frames per poll, flush bytes */
+   int link_record;             /* pack small frames per poll, 0 disable */
+   int link_compress;           /* compress DATA to remote accepting it */
+   int link_compact;            /* compact frame head to remote accepting it */
+   int early_data;              /* ms wait local first bytes for CONNECT, 0 disable */
+   int optimistic_connect;      /* reply local before remote connected */
+   int links;                   /* tcp links to remote */
+   int chann_window;            /* DATA bytes in flight per chann, 0 no limit */
+   int frame_max;               /* encoded frame limit, bulk DATA grows to */
+   int sched_lowat;             /* link unsent bytes for sched, 0 no sched */
+   char sched_high[128];        /* ports or domains interactive */
+   char sched_low[128];         /* ports or domains bulk */
+   int fastopen;                /* TCP Fast Open */
+   int recv_budget;             /* bytes read in one poll, 0 unlimited */
+   int recv_quantum;            /* bytes read per chann in one poll */
 } tunnel_local_config_t;
 
 int tunnel_local_open(tunnel_local_config_t*);
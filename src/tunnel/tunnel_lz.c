@@ -0,0 +1,247 @@
+/*
+ * Copyright (c) 2015 lalawue
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the MIT license. See LICENSE for details.
+ */
+
+#include "tunnel_lz.h"
+#include <stdint.h>
+#include <string.h>
+
+#define _LZ_MIN_MATCH   (4)
+#define _LZ_TAIL_MATCH  (12)          /* no match starts in last bytes */
+#define _LZ_TAIL_LIT    (5)           /* last bytes always literals */
+#define _LZ_MAX_OFFSET  (0xffff)
+
+#define _LZ_SAMPLE_LEN     (1024)
+#define _LZ_SAMPLE_CHUNK   (64)
+#define _LZ_ENTROPY_MAX    (1843)     /* 7.2 bits per byte, in 1/256 */
+
+static inline uint32_t
+_lz_read32(const unsigned char *p) {
+   uint32_t v;
+   memcpy(&v, p, 4);
+   return v;
+}
+
+static inline int
+_lz_hash(uint32_t seq) {
+   return (int)((seq * 2654435761u) >> (32 - TUNNEL_LZ_HASH_BITS));
+}
+
+/* length bytes over 15, return new op, -1 for no room */
+static int
+_lz_put_len(unsigned char *out, int op, int out_cap, int len) {
+   while (len >= 255) {
+      if (op >= out_cap) {
+         return -1;
+      }
+      out[op++] = 255;
+      len -= 255;
+   }
+   if (op >= out_cap) {
+      return -1;
+   }
+   out[op++] = (unsigned char)len;
+   return op;
+}
+
+/* one sequence, match_len 0 for last, return new op, -1 for no room */
+static int
+_lz_emit(unsigned char *out, int op, int out_cap,
+         const unsigned char *lit, int lit_len, int offset, int match_len)
+{
+   int ml = match_len>0 ? match_len - _LZ_MIN_MATCH : 0;
+   if (op >= out_cap) {
+      return -1;
+   }
+
+   out[op++] = (unsigned char)(((lit_len<15 ? lit_len : 15) << 4) | (ml<15 ? ml : 15));
+   if (lit_len >= 15 && (op = _lz_put_len(out, op, out_cap, lit_len - 15)) < 0) {
+      return -1;
+   }
+   if (lit_len > out_cap - op) {
+      return -1;
+   }
+   memcpy(&out[op], lit, lit_len);
+   op += lit_len;
+
+   if (match_len > 0) {
+      if (out_cap - op < 2) {
+         return -1;
+      }
+      out[op++] = offset & 0xff;
+      out[op++] = (offset >> 8) & 0xff;
+      if (ml >= 15 && (op = _lz_put_len(out, op, out_cap, ml - 15)) < 0) {
+         return -1;
+      }
+   }
+   return op;
+}
+
+int
+tunnel_lz_compress(tunnel_lz_t *z, const unsigned char *in, int in_len,
+                   unsigned char *out, int out_cap)
+{
+   if (z==NULL || in==NULL || out==NULL ||
+       in_len<TUNNEL_LZ_MIN_LEN || in_len>0xffffff || out_cap<=3)
+   {
+      return 0;
+   }
+
+   memset(z->table, 0, sizeof(z->table));
+
+   out[0] = (in_len >> 16) & 0xff;
+   out[1] = (in_len >> 8) & 0xff;
+   out[2] = in_len & 0xff;
+
+   int op = 3, ip = 0, anchor = 0;
+   int limit = in_len - _LZ_TAIL_MATCH;
+   int mend = in_len - _LZ_TAIL_LIT;
+
+   while (ip < limit) {
+      uint32_t seq = _lz_read32(&in[ip]);
+      int h = _lz_hash(seq);
+      int cand = z->table[h];
+      z->table[h] = ip;
+
+      if (cand<ip && ip-cand<=_LZ_MAX_OFFSET && _lz_read32(&in[cand])==seq) {
+         int ml = _LZ_MIN_MATCH;
+         while (ip+ml<mend && in[cand+ml]==in[ip+ml]) {
+            ml++;
+         }
+         op = _lz_emit(out, op, out_cap, &in[anchor], ip - anchor, ip - cand, ml);
+         if (op < 0) {
+            return 0;
+         }
+         ip += ml;
+         anchor = ip;
+      }
+      else {
+         /* step faster through data not matching */
+         ip += 1 + ((ip - anchor) >> 6);
+      }
+   }
+
+   op = _lz_emit(out, op, out_cap, &in[anchor], in_len - anchor, 0, 0);
+   return (op < 0) ? 0 : op;
+}
+
+/* length bytes over 15, return new ip, -1 for truncated */
+static int
+_lz_get_len(const unsigned char *in, int ip, int in_len, int *len) {
+   unsigned char b;
+   do {
+      if (ip >= in_len) {
+         return -1;
+      }
+      b = in[ip++];
+      *len += b;
+   } while (b == 255);
+   return ip;
+}
+
+int
+tunnel_lz_decompress(const unsigned char *in, int in_len,
+                     unsigned char *out, int out_cap)
+{
+   if (in==NULL || out==NULL || in_len<3) {
+      return -1;
+   }
+
+   int raw_len = (in[0] << 16) | (in[1] << 8) | in[2];
+   if (raw_len > out_cap) {
+      return -1;
+   }
+
+   int ip = 3, op = 0;
+   while (ip < in_len) {
+      int token = in[ip++];
+
+      int lit_len = token >> 4;
+      if (lit_len==15 && (ip = _lz_get_len(in, ip, in_len, &lit_len)) < 0) {
+         return -1;
+      }
+      if (lit_len>in_len-ip || lit_len>raw_len-op) {
+         return -1;
+      }
+      memcpy(&out[op], &in[ip], lit_len);
+      ip += lit_len;
+      op += lit_len;
+
+      if (ip == in_len) {
+         break;                 /* last sequence */
+      }
+
+      if (in_len - ip < 2) {
+         return -1;
+      }
+      int offset = in[ip] | (in[ip+1] << 8);
+      ip += 2;
+
+      int ml = token & 15;
+      if (ml==15 && (ip = _lz_get_len(in, ip, in_len, &ml)) < 0) {
+         return -1;
+      }
+      ml += _LZ_MIN_MATCH;
+
+      if (offset==0 || offset>op || ml>raw_len-op) {
+         return -1;
+      }
+      /* byte copy, match may overlap output */
+      for (int i=0; i<ml; i++, op++) {
+         out[op] = out[op - offset];
+      }
+   }
+   return (op == raw_len) ? op : -1;
+}
+
+/* log2(v) in 1/256, linear between powers of 2 */
+static int
+_lz_log2(int v) {
+   int n = 0;
+   while ((v >> (n + 1)) > 0) {
+      n++;
+   }
+   return (n << 8) + (int)(((int64_t)(v - (1 << n)) << 8) >> n);
+}
+
+int
+tunnel_lz_worth(const unsigned char *data, int len) {
+   int count[256];
+   int n = 0;
+
+   if (data==NULL || len<=0) {
+      return 0;
+   }
+   memset(count, 0, sizeof(count));
+
+   if (len <= _LZ_SAMPLE_LEN) {
+      for (int i=0; i<len; i++) {
+         count[data[i]]++;
+      }
+      n = len;
+   }
+   else {
+      /* chunks spread over payload, keep local patterns */
+      int chunks = _LZ_SAMPLE_LEN / _LZ_SAMPLE_CHUNK;
+      for (int c=0; c<chunks; c++) {
+         const unsigned char *p = &data[(int64_t)c * (len - _LZ_SAMPLE_CHUNK) / (chunks - 1)];
+         for (int i=0; i<_LZ_SAMPLE_CHUNK; i++) {
+            count[p[i]]++;
+         }
+      }
+      n = _LZ_SAMPLE_LEN;
+   }
+
+   /* H = log2(n) - sum(c * log2(c)) / n */
+   int64_t sum = 0;
+   for (int i=0; i<256; i++) {
+      if (count[i] > 0) {
+         sum += (int64_t)count[i] * _lz_log2(count[i]);
+      }
+   }
+   int entropy = _lz_log2(n) - (int)(sum / n);
+   return entropy < _LZ_ENTROPY_MAX;
+}
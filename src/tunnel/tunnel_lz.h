@@ -0,0 +1,43 @@
+/*
+ * Copyright (c) 2015 lalawue
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the MIT license. See LICENSE for details.
+ */
+
+#ifndef TUNNEL_LZ_H
+#define TUNNEL_LZ_H
+
+/* LZ77 block codec for DATA payload, LZ4 like sequences
+ *
+ * BLOCK   : RAW_LEN | SEQUENCE | SEQUENCE ...
+ *           3 bytes | n bytes
+ *
+ * SEQUENCE: TOKEN  | LITERAL_LEN+ | LITERALS | OFFSET  | MATCH_LEN+
+ *           1 byte | n bytes      | n bytes  | 2 bytes | n bytes
+ *
+ * TOKEN high 4 bits literal length, low 4 bits match length - 4, 15 for
+ * more length bytes following, each added till byte < 255. OFFSET little
+ * endian, last sequence ends after LITERALS
+ */
+
+#define TUNNEL_LZ_HASH_BITS (12)
+#define TUNNEL_LZ_MIN_LEN   (128)     /* smaller payload sent raw */
+#define TUNNEL_LZ_SKIP      (8)       /* frames sent raw after one not shrunk */
+
+typedef struct {
+   int table[1 << TUNNEL_LZ_HASH_BITS];
+} tunnel_lz_t;
+
+/* return block length, 0 when block not smaller than out_cap */
+int tunnel_lz_compress(tunnel_lz_t *z, const unsigned char *in, int in_len,
+                       unsigned char *out, int out_cap);
+
+/* return raw length, -1 for invalid block or out_cap too small */
+int tunnel_lz_decompress(const unsigned char *in, int in_len,
+                         unsigned char *out, int out_cap);
+
+/* sampled byte entropy under limit, 0 for TLS or media like payload */
+int tunnel_lz_worth(const unsigned char *data, int len);
+
+#endif
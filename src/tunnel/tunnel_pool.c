@@ -0,0 +1,205 @@
+/*
+ * Copyright (c) 2015 lalawue
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the MIT license. See LICENSE for details.
+ */
+
+#include "m_debug.h"
+#include "tunnel_pool.h"
+#include <string.h>
+
+#define _err(...) _mlog("pool", D_ERROR, __VA_ARGS__)
+#define _info(...) _mlog("pool", D_INFO, __VA_ARGS__)
+#define _verbose(...) _mlog("pool", D_VERBOSE, __VA_ARGS__)
+
+#define _POOL_BAD_PERIODS (2)   /* decay periods not warmed after break */
+
+static void _pool_timer_cb(mnet_timer_t *t, void *ud);
+
+void
+tunnel_pool_init(tunnel_pool_t *p, int top, int size, int idle) {
+   if (p == NULL) {
+      return;
+   }
+   memset(p, 0, sizeof(*p));
+   p->top = top<TUNNEL_POOL_DEST_MAX ? top : TUNNEL_POOL_DEST_MAX;
+   p->size = size<TUNNEL_POOL_SIZE_MAX ? size : TUNNEL_POOL_SIZE_MAX;
+   p->idle = idle>0 ? idle : 1;
+   if (p->top>0 && p->size>0) {
+      p->timer = mnet_timer_add(TUNNEL_POOL_INTERVAL, TUNNEL_POOL_INTERVAL, _pool_timer_cb, p);
+      _info("pool %d sockets for top %d destinations, idle %d s\n", p->size, p->top, p->idle);
+   }
+}
+
+static int
+_pool_dest_live(tunnel_pool_dest_t *d) {
+   int count = 0;
+   for (int i=0; i<TUNNEL_POOL_SIZE_MAX; i++) {
+      count += d->conns[i].n ? 1 : 0;
+   }
+   return count;
+}
+
+/* description: slot for ip:port, or reuse one least hit without sockets
+ */
+static tunnel_pool_dest_t*
+_pool_dest_find(tunnel_pool_t *p, const char *ip, int port) {
+   tunnel_pool_dest_t *empty = NULL, *least = NULL;
+   for (int i=0; i<TUNNEL_POOL_DEST_MAX; i++) {
+      tunnel_pool_dest_t *d = &p->dests[i];
+      if (d->port == 0) {
+         empty = empty ? empty : d;
+      }
+      else if (d->port==port && strcmp(d->ip, ip)==0) {
+         return d;
+      }
+      else if (_pool_dest_live(d)==0 && (least==NULL || d->hits<least->hits)) {
+         least = d;
+      }
+   }
+   tunnel_pool_dest_t *d = empty ? empty : least;
+   if (d) {
+      memset(d, 0, sizeof(*d));
+      strncpy(d->ip, ip, sizeof(d->ip) - 1);
+      d->port = port;
+   }
+   return d;
+}
+
+/* description: enough hits and ranked in top
+ */
+static int
+_pool_dest_hot(tunnel_pool_t *p, tunnel_pool_dest_t *d) {
+   if (d->bad>0 || d->hits<TUNNEL_POOL_HOT_HITS) {
+      return 0;
+   }
+   int rank = 0;
+   for (int i=0; i<TUNNEL_POOL_DEST_MAX; i++) {
+      rank += (p->dests[i].hits > d->hits) ? 1 : 0;
+   }
+   return rank < p->top;
+}
+
+static void
+_pool_conn_close(tunnel_pool_conn_t *pc) {
+   mnet_chann_set_cb(pc->n, NULL, NULL);
+   mnet_chann_close(pc->n);
+   memset(pc, 0, sizeof(*pc));
+}
+
+/* description: idle socket readable means peer closed or server spoke
+ * first, neither safe to hand over
+ */
+static void
+_pool_conn_cb(chann_event_t *e) {
+   tunnel_pool_conn_t *pc = (tunnel_pool_conn_t*)e->opaque;
+   if (e->event == MNET_EVENT_CONNECT) {
+      pc->connected = 1;
+      pc->since = time(NULL);
+   }
+   else if (e->event==MNET_EVENT_RECV || e->event==MNET_EVENT_DISCONNECT) {
+      tunnel_pool_dest_t *d = pc->dest;
+      _verbose("pool %s:%d drop socket, event %d\n", d->ip, d->port, e->event);
+      d->bad = _POOL_BAD_PERIODS;
+      _pool_conn_close(pc);
+   }
+   else if (e->event == MNET_EVENT_CLOSE) {
+      /* destroyed by mnet after event */
+      pc->dest->bad = _POOL_BAD_PERIODS;
+      memset(pc, 0, sizeof(*pc));
+   }
+}
+
+/* description: sockets handed out recently and one spare, idle ones not
+ * asked for only churn connects to origin
+ */
+static void
+_pool_dest_fill(tunnel_pool_t *p, tunnel_pool_dest_t *d) {
+   int count = _pool_dest_live(d);
+   int want = (d->taken > d->demand ? d->taken : d->demand) + 1;
+   want = want < p->size ? want : p->size;
+   for (int i=0; i<TUNNEL_POOL_SIZE_MAX && count<want; i++) {
+      tunnel_pool_conn_t *pc = &d->conns[i];
+      if (pc->n) {
+         continue;
+      }
+      pc->n = mnet_chann_open(CHANN_TYPE_STREAM);
+      pc->connected = 0;
+      pc->since = time(NULL);
+      pc->dest = d;
+      mnet_chann_set_cb(pc->n, _pool_conn_cb, pc);
+      if (mnet_chann_connect(pc->n, d->ip, d->port) <= 0) {
+         _err("pool fail to connect %s:%d\n", d->ip, d->port);
+         d->bad = _POOL_BAD_PERIODS;
+         _pool_conn_close(pc);
+         return;
+      }
+      count += 1;
+   }
+}
+
+chann_t*
+tunnel_pool_get(tunnel_pool_t *p, const char *ip, int port) {
+   if (p==NULL || p->timer==NULL || ip==NULL) {
+      return NULL;
+   }
+   tunnel_pool_dest_t *d = _pool_dest_find(p, ip, port);
+   if (d == NULL) {
+      return NULL;
+   }
+   d->hits += 1;
+
+   chann_t *n = NULL;
+   for (int i=0; i<TUNNEL_POOL_SIZE_MAX; i++) {
+      tunnel_pool_conn_t *pc = &d->conns[i];
+      if (pc->n && pc->connected &&
+          mnet_chann_state(pc->n) == CHANN_STATE_CONNECTED)
+      {
+         n = pc->n;
+         mnet_chann_set_cb(n, NULL, NULL);
+         memset(pc, 0, sizeof(*pc));
+         d->taken += 1;
+         break;
+      }
+   }
+   if ( _pool_dest_hot(p, d) ) {
+      _pool_dest_fill(p, d);
+   }
+   return n;
+}
+
+/* description: expire idle sockets and decay hits, refilled only when
+ * next connect comes, an idle destination drains without reconnects
+ */
+static void
+_pool_timer_cb(mnet_timer_t *t, void *ud) {
+   tunnel_pool_t *p = (tunnel_pool_t*)ud;
+   time_t now = time(NULL);
+   int decay = (++p->ticks % TUNNEL_POOL_DECAY) == 0;
+
+   for (int i=0; i<TUNNEL_POOL_DEST_MAX; i++) {
+      tunnel_pool_dest_t *d = &p->dests[i];
+      if (d->port == 0) {
+         continue;
+      }
+      for (int j=0; j<TUNNEL_POOL_SIZE_MAX; j++) {
+         tunnel_pool_conn_t *pc = &d->conns[j];
+         if (pc->n && now - pc->since >= p->idle) {
+            /* not asked for, lower demand */
+            _pool_conn_close(pc);
+            d->taken -= (d->taken > 0) ? 1 : 0;
+            d->demand -= (d->demand > 0) ? 1 : 0;
+         }
+      }
+      if ( decay ) {
+         d->hits >>= 1;
+         d->demand = d->taken;
+         d->taken = 0;
+         d->bad -= (d->bad > 0) ? 1 : 0;
+      }
+      if (d->hits==0 && _pool_dest_live(d)==0) {
+         memset(d, 0, sizeof(*d));
+      }
+   }
+}
@@ -0,0 +1,58 @@
+/*
+ * Copyright (c) 2015 lalawue
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the MIT license. See LICENSE for details.
+ */
+
+#ifndef TUNNEL_POOL_H
+#define TUNNEL_POOL_H
+
+#include <time.h>
+#include "plat_net.h"
+
+/* outbound sockets connected ahead for hot destinations, hits counted per
+   ip:port and halved every decay period, top ones kept warm */
+
+#define TUNNEL_POOL_DEST_MAX  (64)     /* destinations counted */
+#define TUNNEL_POOL_SIZE_MAX  (8)      /* idle sockets per destination */
+#define TUNNEL_POOL_HOT_HITS  (4)      /* hits in decay period to be warmed */
+#define TUNNEL_POOL_INTERVAL  (1000)   /* ms, expire and refill */
+#define TUNNEL_POOL_DECAY     (10)     /* intervals hits halved */
+
+struct s_pool_dest;
+
+typedef struct {
+   chann_t *n;
+   int connected;
+   time_t since;                /* connected time */
+   struct s_pool_dest *dest;
+} tunnel_pool_conn_t;
+
+typedef struct s_pool_dest {
+   char ip[16];
+   int port;
+   int hits;
+   int taken;                   /* sockets handed out in decay period */
+   int demand;                  /* taken in last decay period */
+   int bad;                     /* decay periods not warmed, idle one broke */
+   tunnel_pool_conn_t conns[TUNNEL_POOL_SIZE_MAX];
+} tunnel_pool_dest_t;
+
+typedef struct {
+   int top;                     /* hot destinations kept warm */
+   int size;                    /* idle sockets per hot destination */
+   int idle;                    /* seconds idle socket kept */
+   int ticks;
+   mnet_timer_t *timer;
+   tunnel_pool_dest_t dests[TUNNEL_POOL_DEST_MAX];
+} tunnel_pool_t;
+
+/* pool disabled when size or top <= 0, after mnet init */
+void tunnel_pool_init(tunnel_pool_t *p, int top, int size, int idle);
+
+/* count connect to ip:port, return connected chann detached from pool, or
+   NULL to connect a new one */
+chann_t* tunnel_pool_get(tunnel_pool_t *p, const char *ip, int port);
+
+#endif
@@ -32,6 +32,9 @@
 #include "tunnel_dns.h"
 #include "tunnel_remote.h"
 #include "tunnel_crypto.h"
+#include "tunnel_sched.h"
+#include "tunnel_lz.h"
+#include "tunnel_pool.h"
 
 #include <assert.h>
 
@@ -39,6 +42,8 @@
 #define _info(...) _mlog("remote", D_INFO, __VA_ARGS__)
 #define _verbose(...) _mlog("remote", D_VERBOSE, __VA_ARGS__)
 
+#define _REMOTE_DNS_WAKE (10)   /* ms, poll wakes for dns answers */
+
 #ifdef TEST_TUNNEL_REMOTE
 
 typedef enum {
@@ -58,7 +63,10 @@ typedef struct {
    int port;
    int chann_id;
    int magic;
+   int prio;                    /* sched class by domain */
    void *opaque;
+   int early_len;
+   unsigned char early[1];      /* local first bytes in CONNECT */
 } dns_query_t;
 
 typedef struct {
@@ -67,15 +75,38 @@ typedef struct {
    int magic;                   /* from local chann magic */
    chann_t *tcpout;
    buf_t *bufout;
+   int over_mark;               /* tcpout send queue over high mark */
+   time_t deadline;             /* expire time of current state */
+   time_t timer_at;             /* timer fire time */
+   mnet_timer_t *timer;
    lst_node_t *node;            /* node in active_lst */
    void *client;                /* client pointer */
+   int send_window;             /* DATA bytes local still accepts */
+   int recv_pending;            /* DATA bytes from local not granted back */
+   int grant_wait;              /* wait tcpout drained to grant */
+   int frame_size;              /* DATA payload of next read, grows for bulk */
+   int lz_skip;                 /* DATA frames sent raw before compress again */
+   tunnel_sched_flow_t flow;    /* frames in client sched */
 } tun_remote_chann_t;
 
 typedef struct {
    int data_mark;
+   int over_count;              /* chann over high mark, pause tcpin */
+   int link_over;               /* tcpin over high mark, pause channs */
+   int peer_flow;               /* local knows WINDOW_UPDATE */
+   int peer_window;             /* local chann window, 0 no limit */
+   int peer_record;             /* local accepts RECORD */
+   int frame_max;               /* encoded frame limit both sides accept */
+   int peer_lz;                 /* local accepts DATA_LZ */
+   int head;                    /* TUNNEL_CMD_HEAD_* of frames sent */
    remote_client_state_t state;
+   mnet_timer_t *timer;         /* auth timeout */
    chann_t *tcpin;
    buf_t *bufin;
+   buf_t *record;               /* small frames packed till poll round end */
+   tunnel_sched_t sched;        /* DATA frames wait for tcpin */
+   int sched_credit;            /* bytes to tcpin before unsent checked */
+   int sched_wait;              /* wait tcpin SEND event */
    lst_t *active_lst;
    lst_t *free_lst;
    lst_node_t *node;            /* node in clients_lst */
@@ -86,15 +117,25 @@ typedef struct {
    int running;
    time_t ti;
    uint64_t key;
-   int timer_active;
    tunnel_remote_mode_t mode;
    tunnel_remote_config_t conf;
+   struct {
+      int handshake;
+      int connect;
+      int idle;
+   } expired;                   /* timeout stats */
    chann_t *tcpin;
    chann_t *tcpout;             /* for mode forward */
    buf_t *buftmp;               /* buf for crypto */
+   buf_t *bufbulk;              /* buf for DATA frame over chann buf */
+   buf_t *buflz;                /* buf for DATA_LZ frame or its payload */
+   tunnel_lz_t lz;              /* compress hash table */
+   tunnel_pool_t pool;          /* tcpout connected ahead */
    lst_t *clients_lst;          /* acitve cilent */
    lst_t *leave_lst;            /* client to leave */
    stm_t *ip_stm;
+   int dns_pending;             /* queries not answered in ip_stm */
+   mnet_timer_t *dns_timer;     /* wake poll while dns pending */
 } tun_remote_t;
 
 static tun_remote_t _g_remote;
@@ -103,18 +144,30 @@ static void _remote_tcpout_cb(chann_event_t *e);
 static void _remote_tcpin_cb(chann_event_t *e);
 static void _remote_chann_closing(tun_remote_chann_t*);
 static void _remote_chann_close(tun_remote_chann_t*);
+static void _remote_chann_active(tun_remote_chann_t*);
+static void _remote_chann_connected(tun_remote_chann_t*);
+static void _remote_client_timer_cb(mnet_timer_t*, void*);
+static int _remote_sched_send(unsigned char*, int, void*);
+static void _remote_sched_drain(tunnel_sched_flow_t*);
 
 static inline tun_remote_t* _tun_remote(void) {
    return &_g_remote;
 }
 
 static dns_query_t*
-_dns_query_create(int port, int chann_id, int magic, void *opaque) {
-   dns_query_t *q = (dns_query_t*)mm_malloc(sizeof(*q));
+_dns_query_create(int port, int chann_id, int magic, int prio,
+                  unsigned char *early, int early_len, void *opaque)
+{
+   dns_query_t *q = (dns_query_t*)mm_malloc(sizeof(*q) + early_len);
    q->port = port;
    q->chann_id = chann_id;
    q->magic = magic;
+   q->prio = prio;
    q->opaque = opaque;
+   q->early_len = early_len;
+   if (early_len > 0) {
+      memcpy(q->early, early, early_len);
+   }
    return q;
 }
 
@@ -123,17 +176,43 @@ _dns_query_destroy(dns_query_t *query) {
    mm_free(query);
 }
 
+static void
+_remote_link_setopt(chann_t *n, tunnel_remote_config_t *conf) {
+   if (conf->link_buffer < 0) {
+      mnet_chann_setopt(n, MNET_OPT_AUTOTUNE, TUNNEL_LINK_TUNE_MAX);
+   } else if (conf->link_buffer > 0) {
+      mnet_chann_setopt(n, MNET_OPT_SNDBUF, conf->link_buffer);
+      mnet_chann_setopt(n, MNET_OPT_RCVBUF, conf->link_buffer);
+   }
+   mnet_chann_setopt(n, MNET_OPT_NODELAY, conf->link_nodelay);
+   mnet_chann_set_cork(n, conf->link_cork);
+   if (conf->sched_lowat > 0) {
+      mnet_chann_setopt(n, MNET_OPT_NOTSENT_LOWAT, conf->sched_lowat);
+   }
+}
+
 static tun_remote_client_t*
 _remote_client_create(chann_t *n) {
    tun_remote_t *tun = _tun_remote();
    tun_remote_client_t *c = (tun_remote_client_t*)mm_malloc(sizeof(*c));
    c->tcpin = n;
-   c->bufin = buf_create(TUNNEL_CHANN_BUF_SIZE);
+   c->bufin = buf_create(TUNNEL_LINK_BUF_SIZE);
    assert(c->bufin);
+   c->frame_max = TUNNEL_CHANN_BUF_SIZE;
+   if (tun->conf.link_record > 0) {
+      c->record = buf_create(_MIN_OF(tun->conf.link_record, TUNNEL_RECORD_MAX));
+      assert(c->record);
+   }
    c->active_lst = lst_create();
    c->free_lst = lst_create();
    c->node = lst_pushl(tun->clients_lst, c);
+   tunnel_sched_init(&c->sched, _remote_sched_send, _remote_sched_drain, c);
    mnet_chann_set_cb(n, _remote_tcpin_cb, c);
+   if (tun->conf.handshake_timeout > 0) {
+      c->timer = mnet_timer_add(tun->conf.handshake_timeout * 1000, 0, _remote_client_timer_cb, c);
+   }
+   mnet_chann_set_watermark(n, TUNNEL_LINK_LOW_MARK, TUNNEL_LINK_HIGH_MARK);
+   _remote_link_setopt(n, &tun->conf);
    //_verbose("client create %p(%p), %d\n", c, c->tcpin, lst_count(tun->clients_lst));
    return c;
 }
@@ -142,6 +221,10 @@ static void
 _remote_client_destroy(tun_remote_client_t *c) {
    tun_remote_t *tun = _tun_remote();
    if (c->node) {
+      if (c->timer) {
+         mnet_timer_cancel(c->timer);
+         c->timer = NULL;
+      }
       mnet_chann_set_cb(c->tcpin, NULL, NULL);
       if (mnet_chann_state(c->tcpin) >= CHANN_STATE_CONNECTING) {
          mnet_chann_close(c->tcpin);
@@ -149,6 +232,11 @@ _remote_client_destroy(tun_remote_client_t *c) {
 
       buf_destroy(c->bufin);
       c->bufin = NULL;
+      if (c->record) {
+         buf_destroy(c->record);
+         c->record = NULL;
+      }
+      tunnel_sched_clear(&c->sched);
 
       while (lst_count(c->active_lst) > 0) {
          tun_remote_chann_t *rc = lst_first(c->active_lst);
@@ -172,10 +260,16 @@ _remote_client_destroy(tun_remote_client_t *c) {
 }
 
 static tun_remote_chann_t*
-_remote_chann_open(tun_remote_client_t *c, tunnel_cmd_t *tcmd, char *addr, int port) {
-   tun_remote_chann_t *rc = NULL;
-   if ( c->channs[tcmd->chann_id] ) {
-      return c->channs[tcmd->chann_id];
+_remote_chann_open(tun_remote_client_t *c, tunnel_cmd_t *tcmd, char *addr, int port, int prio) {
+   tun_remote_t *tun = _tun_remote();
+   tun_remote_chann_t *rc = c->channs[tcmd->chann_id];
+   if ( rc ) {
+      if (rc->magic == tcmd->magic) {
+         return rc;
+      }
+      /* chann id reused by front, old one still closing */
+      _remote_chann_close(rc);
+      rc = NULL;
    }
 
    if (lst_count(c->free_lst) > 0) {
@@ -184,15 +278,41 @@ _remote_chann_open(tun_remote_client_t *c, tunnel_cmd_t *tcmd, char *addr, int p
       rc = (tun_remote_chann_t*)mm_malloc(sizeof(*rc));
       rc->bufout = buf_create(TUNNEL_CHANN_BUF_SIZE);
       assert(rc->bufout);
+      tunnel_sched_flow_init(&rc->flow, prio, rc);
    }
+   rc->flow.prio = prio;
    rc->chann_id = tcmd->chann_id;
    rc->magic = tcmd->magic;
    rc->client = (void*)c;
+   rc->over_mark = 0;
+   rc->send_window = c->peer_window;
+   rc->recv_pending = 0;
+   rc->grant_wait = 0;
+   rc->frame_size = 0;
+   rc->lz_skip = 0;
    rc->node = lst_pushl(c->active_lst, rc);
-   rc->tcpout = mnet_chann_open(CHANN_TYPE_STREAM);
+   rc->tcpout = tunnel_pool_get(&tun->pool, addr, port);
+   int pooled = (rc->tcpout != NULL);
+   if ( !pooled ) {
+      rc->tcpout = mnet_chann_open(CHANN_TYPE_STREAM);
+   }
 
    c->channs[tcmd->chann_id] = rc;
    mnet_chann_set_cb(rc->tcpout, _remote_tcpout_cb, rc);
+   mnet_chann_set_watermark(rc->tcpout, TUNNEL_CHANN_LOW_MARK, TUNNEL_CHANN_HIGH_MARK);
+   if ( c->link_over ) {
+      mnet_chann_active_event(rc->tcpout, MNET_EVENT_RECV, 0);
+   }
+   rc->state = REMOTE_CHANN_STATE_NONE;
+   if ( pooled ) {
+      _verbose("chann %d:%d connected from pool\n", rc->chann_id, rc->magic);
+      _remote_chann_connected(rc);
+      return rc;
+   }
+   _remote_chann_active(rc);
+   if ( tun->conf.fastopen ) {
+      mnet_chann_setopt(rc->tcpout, MNET_OPT_FASTOPEN, 1);
+   }
 
    if (mnet_chann_connect(rc->tcpout, addr, port) > 0) {
       /* _verbose("chann %d:%d open, [a:%d, f:%d]\n", rc->chann_id, rc->magic, */
@@ -203,10 +323,57 @@ _remote_chann_open(tun_remote_client_t *c, tunnel_cmd_t *tcmd, char *addr, int p
    return NULL;
 }
 
+/* description: chann tcpout over high mark or not, pause client tcpin
+ * reading while any chann over
+ */
+static void
+_remote_chann_mark(tun_remote_chann_t *rc, int over) {
+   tun_remote_client_t *c = (tun_remote_client_t*)rc->client;
+   if (rc->over_mark == over) {
+      return;
+   }
+   rc->over_mark = over;
+   c->over_count += over ? 1 : -1;
+   if (mnet_chann_state(c->tcpin) == CHANN_STATE_CONNECTED) {
+      if (over && c->over_count == 1) {
+         mnet_chann_active_event(c->tcpin, MNET_EVENT_RECV, 0);
+      }
+      else if (!over && c->over_count == 0) {
+         mnet_chann_active_event(c->tcpin, MNET_EVENT_RECV, 1);
+      }
+   }
+}
+
+/* description: tcpout reads while client under high mark and local window
+ * left
+ */
+static void
+_remote_chann_recv_update(tun_remote_chann_t *rc) {
+   tun_remote_client_t *c = (tun_remote_client_t*)rc->client;
+   int active = !c->link_over && (c->peer_window<=0 || rc->send_window>0) &&
+      rc->flow.bytes < TUNNEL_SCHED_FLOW_MAX;
+   mnet_chann_active_event(rc->tcpout, MNET_EVENT_RECV, active);
+}
+
+/* description: client tcpin over high mark or not, pause channs reading
+ */
+static void
+_remote_link_mark(tun_remote_client_t *c, int over) {
+   c->link_over = over;
+   lst_foreach(it, c->active_lst) {
+      tun_remote_chann_t *rc = (tun_remote_chann_t*)lst_iter_data(it);
+      if (mnet_chann_state(rc->tcpout) >= CHANN_STATE_CONNECTING) {
+         _remote_chann_recv_update(rc);
+      }
+   }
+}
+
 void
 _remote_chann_closing(tun_remote_chann_t *rc) {
    /* _verbose("chann %d:%d closing %p\n", rc->chann_id, rc->magic, rc); */
 
+   _remote_chann_mark(rc, 0);
+
    rc->state = REMOTE_CHANN_STATE_DISCONNECT;
 
    if (mnet_chann_state(rc->tcpout) >= CHANN_STATE_CONNECTING) {
@@ -224,6 +391,11 @@ _remote_chann_close(tun_remote_chann_t *rc) {
       mnet_chann_set_cb(rc->tcpout, NULL, NULL);
       _remote_chann_closing(rc);
 
+      if (rc->timer) {
+         mnet_timer_cancel(rc->timer);
+         rc->timer = NULL;
+      }
+
       c->channs[rc->chann_id] = NULL;
       rc->chann_id = 0;
 
@@ -249,6 +421,22 @@ _remote_chann_of_id_magic(tun_remote_client_t *c, int chann_id, int magic) {
    return NULL;
 }
 
+/* description: chann of frame, compact head carries magic low bits
+ */
+static tun_remote_chann_t*
+_remote_chann_of_cmd(tun_remote_client_t *c, tunnel_cmd_t *tcmd) {
+   if (c && tcmd) {
+      if (tcmd->chann_id>=0 && tcmd->chann_id<TUNNEL_CHANN_MAX_COUNT) {
+         tun_remote_chann_t *rc = c->channs[tcmd->chann_id];
+         if (rc && tunnel_cmd_magic_match(tcmd, rc->magic)) {
+            return rc;
+         }
+         _err("invalid remote chann %d:%d\n", tcmd->chann_id, tcmd->magic);
+      }
+   }
+   return NULL;
+}
+
 static void
 _remote_aux_dns_cb(char *addr, int addr_len, void *opaque) {
    tun_remote_t *tun = _tun_remote();
@@ -264,28 +452,154 @@ _remote_aux_dns_cb(char *addr, int addr_len, void *opaque) {
    stm_pushl(tun->ip_stm, q);
 }
 
+static void
+_remote_dns_wake_cb(mnet_timer_t *t, void *ud) {
+   /* poll returns, answers drained in main loop */
+}
+
+/* description: answered in dns thread, poll not woken by it, so timer
+ * keeps waking poll till all answered
+ */
+static void
+_remote_dns_query(const char *domain, dns_query_t *q) {
+   tun_remote_t *tun = _tun_remote();
+   tun->dns_pending += 1;
+   if (tun->dns_timer == NULL) {
+      tun->dns_timer = mnet_timer_add(_REMOTE_DNS_WAKE, _REMOTE_DNS_WAKE, _remote_dns_wake_cb, tun);
+   }
+   dns_query_domain(domain, strlen(domain), _remote_aux_dns_cb, q);
+}
+
+/* description: encode one frame or record to tcpin, unit is frame
+ * without classic length head
+ */
 static int
-_remote_send_front_data(tun_remote_client_t *c, unsigned char *buf, int buf_len) {
+_remote_client_send(tun_remote_client_t *c, unsigned char *unit, int unit_len) {
+   struct iovec iov[2];
 
 #ifdef DEF_TUNNEL_SIMPLE_CRYPTO
-   mc_enc_exp(&buf[3], buf_len-3);
-   return mnet_chann_send(c->tcpin, buf, buf_len);
+   unsigned char head[3];
+   mc_enc_exp(unit, unit_len);
+   tunnel_cmd_data_len(head, 1, unit_len + 3);
 #else
    tun_remote_t *tun = _tun_remote();
-   char *tbuf = (char*)buf_addr(tun->buftmp,0);
+   /* encode inplace, send head and payload without staging copy */
+   unsigned char head[3 + 8];
 
-   int data_len = mc_encrypt((char*)&buf[3], buf_len-3, &tbuf[3], tun->key, tun->ti);
+   int data_len = mc_encrypt_ex((char*)unit, unit_len, (char*)&head[3], (char*)unit, tun->key, tun->ti);
    assert(data_len > 0);
 
-   tunnel_cmd_data_len((void*)tbuf, 1, data_len + 3);   
-   return mnet_chann_send(c->tcpin, tbuf, data_len + 3);
+   tunnel_cmd_data_len(head, 1, data_len + 3);
 #endif
+   iov[0].iov_base = head;
+   iov[0].iov_len = sizeof(head);
+   iov[1].iov_base = unit;
+   iov[1].iov_len = unit_len;
+   return mnet_chann_sendv(c->tcpin, iov, 2);
+}
+
+/* description: send frames packed in client record
+ */
+static void
+_remote_client_flush(tun_remote_client_t *c) {
+   int len = 0;
+   unsigned char *d = tunnel_cmd_record_seal(c->record, c->head, &len);
+   if ( d ) {
+      d = tunnel_cmd_unit(d, &len);
+      _remote_client_send(c, d, len);
+   }
 }
 
+/* description: frame packed in client head, small ones into client
+ * record, encoded once when record full or poll round ends
+ */
 static int
-_remote_recv_front_data(tun_remote_client_t *c, buf_t *b) {
-   char *buf = (char*)buf_addr(b,0);
-   int buf_len = buf_buffered(b);
+_remote_send_front_data(tun_remote_client_t *c, unsigned char *buf, int buf_len) {
+   int raw_len = buf_len;
+   buf_len = tunnel_cmd_pack(c->head, buf, buf_len, &buf);
+
+   if (c->peer_record && c->record && buf_len<=TUNNEL_RECORD_FRAME_MAX) {
+      if ( tunnel_cmd_record_append(c->record, c->head, buf, buf_len) ) {
+         return raw_len;
+      }
+      _remote_client_flush(c);
+      if ( tunnel_cmd_record_append(c->record, c->head, buf, buf_len) ) {
+         return raw_len;
+      }
+   }
+
+   /* keep frame order */
+   _remote_client_flush(c);
+   buf = tunnel_cmd_unit(buf, &buf_len);
+   int ret = _remote_client_send(c, buf, buf_len);
+   return (ret > 0) ? raw_len : ret;
+}
+
+static int
+_remote_sched_send(unsigned char *frame, int len, void *ud) {
+   return _remote_send_front_data((tun_remote_client_t*)ud, frame, len);
+}
+
+static void
+_remote_sched_drain(tunnel_sched_flow_t *f) {
+   tun_remote_chann_t *rc = (tun_remote_chann_t*)f->ud;
+   if (rc->state == REMOTE_CHANN_STATE_CONNECTED) {
+      _remote_chann_recv_update(rc);
+   }
+}
+
+/* description: bytes tcpin takes before kernel unsent checked again
+ */
+static int
+_remote_client_budget(tun_remote_client_t *c) {
+   if (c->sched_credit <= 0) {
+      c->sched_credit = _tun_remote()->conf.sched_lowat - mnet_chann_unsent(c->tcpin);
+   }
+   return c->sched_credit;
+}
+
+/* description: feed tcpin from sched while unsent under low mark, or wait
+ * tcpin SEND event
+ */
+static void
+_remote_client_sched(tun_remote_client_t *c) {
+   while (c->sched.bytes>0 && _remote_client_budget(c)>0) {
+      c->sched_credit -= tunnel_sched_run(&c->sched, c->sched_credit);
+   }
+   int wait = (c->sched.bytes > 0);
+   if (wait != c->sched_wait) {
+      c->sched_wait = wait;
+      mnet_chann_active_event(c->tcpin, MNET_EVENT_SEND, wait);
+   }
+}
+
+/* description: DATA straight to tcpin when nothing queued, or queued in
+ * sched till tcpin ready
+ */
+static void
+_remote_chann_send_data(tun_remote_chann_t *rc, unsigned char *data, int data_len) {
+   tun_remote_client_t *c = (tun_remote_client_t*)rc->client;
+   if (_tun_remote()->conf.sched_lowat <= 0) {
+      _remote_send_front_data(c, data, data_len);
+   }
+   else if (c->sched.bytes<=0 && _remote_client_budget(c)>0) {
+      _remote_send_front_data(c, data, data_len);
+      c->sched_credit -= data_len;
+   }
+   else {
+      tunnel_sched_push(&c->sched, &rc->flow, data, data_len);
+      _remote_client_sched(c);
+      if (rc->flow.bytes >= TUNNEL_SCHED_FLOW_MAX) {
+         _remote_chann_recv_update(rc);
+      }
+   }
+}
+
+/* decode frame in place, return plain frame in its head, NULL for invalid */
+static unsigned char*
+_remote_recv_front_data(tun_remote_client_t *c, unsigned char *frame, int *frame_len) {
+   char *buf = (char*)frame;
+   int buf_len = *frame_len;
 
 #ifdef DEF_TUNNEL_SIMPLE_CRYPTO
    mc_dec_exp((unsigned char*)&buf[3], buf_len-3);
@@ -296,16 +610,13 @@ _remote_recv_front_data(tun_remote_client_t *c, buf_t *b) {
    int data_len = mc_decrypt(&buf[3], buf_len-3, tbuf, tun->key, tun->ti);
    if (data_len <= 0) {
       _err("Invalid data_len !\n");
-      return 0;
+      return NULL;
    }
 
    memcpy(&buf[3], tbuf, data_len);
-   tunnel_cmd_data_len((void*)buf, 1, data_len + 3);
-
-   buf_reset(b);
-   buf_forward_ptw(b, data_len + 3);
+   *frame_len = data_len + 3;
 #endif
-   return 1;
+   return tunnel_cmd_unit_frame(frame, frame_len);
 }
 
 static void
@@ -387,149 +698,376 @@ _remote_send_close(tun_remote_client_t *c, tun_remote_chann_t *rc, int result) {
 
    data[data_len - 1] = result; /* omit */
 
-   _remote_send_front_data(c, data, data_len);
+   if (rc->flow.bytes > 0) {
+      /* after DATA queued */
+      tunnel_sched_push(&c->sched, &rc->flow, data, data_len);
+   } else {
+      _remote_send_front_data(c, data, data_len);
+   }
 }
 
-void
-_remote_tcpin_cb(chann_event_t *e) {
-   tun_remote_client_t *c = (tun_remote_client_t*)e->opaque;
-   if (c->bufin == NULL) {
+/* description: grant local window back for DATA written out of tcpout,
+ * wait SEND event while tcpout still caching
+ */
+static void
+_remote_chann_grant(tun_remote_chann_t *rc) {
+   tun_remote_t *tun = _tun_remote();
+   tun_remote_client_t *c = (tun_remote_client_t*)rc->client;
+   int window = tun->conf.chann_window;
+
+   if (window<=0 || !c->peer_flow) {
       return;
    }
 
-   if (e->event == MNET_EVENT_RECV) {
-      tunnel_cmd_t tcmd = {0, 0, 0, 0, NULL};
+   int cached = mnet_chann_cached(rc->tcpout);
+   int grant = rc->recv_pending - cached;
 
-      for (;;) {
-         int ret = 0;
-         buf_t *ib = c->bufin;
+   if (grant > 0 && grant >= window/2) {
+      unsigned char data[32] = {0};
+      int data_len = TUNNEL_CMD_CONST_HEADER_LEN + 4;
 
-         if (buf_buffered(ib) < TUNNEL_CMD_CONST_HEADER_LEN) {
-            ret = mnet_chann_recv(e->n, buf_addr(ib,buf_ptw(ib)), TUNNEL_CMD_CONST_HEADER_LEN - buf_buffered(ib));
-         } else {
-            tunnel_cmd_check(ib, &tcmd);
-            ret = mnet_chann_recv(e->n, buf_addr(ib,buf_ptw(ib)), tcmd.data_len - buf_buffered(ib));
-         }
+      tunnel_cmd_data_len(data, 1, data_len);
+      tunnel_cmd_chann_id(data, 1, rc->chann_id);
+      tunnel_cmd_chann_magic(data, 1, rc->magic);
+      tunnel_cmd_head_cmd(data, 1, TUNNEL_CMD_WINDOW);
+      tunnel_cmd_window(&data[TUNNEL_CMD_CONST_HEADER_LEN], 1, grant);
 
-         if (ret <= 0) {
-            return;
-         }
-         buf_forward_ptw(ib, ret);
+      _remote_send_front_data(c, data, data_len);
+      rc->recv_pending -= grant;
+   }
 
-         if (buf_buffered(ib) <= TUNNEL_CMD_CONST_HEADER_LEN) {
-            continue;
-         }
-         if (tcmd.data_len != buf_buffered(ib)) {
-            return;
-         }
+   int wait = (cached > 0) && (rc->recv_pending >= window/2);
+   if (wait != rc->grant_wait) {
+      rc->grant_wait = wait;
+      mnet_chann_active_event(rc->tcpout, MNET_EVENT_SEND, wait);
+   }
+}
 
-         /* decode data */
-         if (_remote_recv_front_data(c, ib) <= 0) {
-            goto reset_buffer;
-         }
+/* description: local first bytes from CONNECT, cached till tcpout
+ * connected, sent in SYN with fast open
+ */
+static void
+_remote_chann_early(tun_remote_chann_t *rc, unsigned char *data, int data_len) {
+   if (rc && data_len>0) {
+      mnet_chann_send(rc->tcpout, data, data_len);
+      rc->recv_pending += data_len;
+      _remote_chann_grant(rc);
+   }
+}
 
-         /* _verbose("%d, %d\n", tcmd.data_len, buf_buffered(ib)); */
-         tunnel_cmd_check(ib, &tcmd);
-         if (tcmd.cmd<=TUNNEL_CMD_NONE || tcmd.cmd>TUNNEL_CMD_DATA) {
-            assert(0);
-         }
+/* description: timeout of chann state in seconds
+ */
+static int
+_remote_chann_timeout(tun_remote_t *tun, tun_remote_chann_t *rc) {
+   switch (rc->state) {
+      case REMOTE_CHANN_STATE_NONE:
+         return tun->conf.connect_timeout;
+      case REMOTE_CHANN_STATE_CONNECTED:
+         return tun->conf.idle_timeout;
+      default:
+         return 0;
+   }
+}
 
-         c->data_mark++;
+static void
+_remote_chann_timer_cb(mnet_timer_t *t, void *ud) {
+   tun_remote_t *tun = _tun_remote();
+   tun_remote_chann_t *rc = (tun_remote_chann_t*)ud;
+   tun_remote_client_t *c = (tun_remote_client_t*)rc->client;
+   time_t now = time(NULL);
 
-         if (tcmd.cmd == TUNNEL_CMD_ECHO) {
-            _remote_send_echo(c);
-            goto reset_buffer;
-         }
+   if (rc->deadline > now) {
+      /* deadline moved since armed */
+      rc->timer_at = rc->deadline;
+      mnet_timer_reset(t, (int)(rc->deadline - now) * 1000);
+      return;
+   }
+
+   rc->timer = NULL;            /* once timer freed after callback */
+   if (rc->deadline <= 0) {
+      return;
+   }
 
-         /* _info("get cmd %d\n", tcmd.cmd); */
-         if (c->state == REMOTE_CLIENT_STATE_ACCEPT) {
+   if (rc->state == REMOTE_CHANN_STATE_NONE) {
+      tun->expired.connect++;
+      _verbose("chann %d:%d connect timeout\n", rc->chann_id, rc->magic);
+      _remote_send_connect_result(c, rc->chann_id, rc->magic, 0);
+      _remote_chann_close(rc);
+   }
+   else if (rc->state == REMOTE_CHANN_STATE_CONNECTED) {
+      tun->expired.idle++;
+      _verbose("chann %d:%d idle timeout\n", rc->chann_id, rc->magic);
+      _remote_send_close(c, rc, 1);
+      _remote_chann_close(rc);
+   }
+}
 
-            if (tcmd.cmd == TUNNEL_CMD_DATA) {
-               tun_remote_chann_t *rc = _remote_chann_of_id_magic(c, tcmd.chann_id, tcmd.magic);
+/* description: update deadline on state change or data, the timer only
+ * re-armed when fired before deadline
+ */
+static void
+_remote_chann_active(tun_remote_chann_t *rc) {
+   tun_remote_t *tun = _tun_remote();
+   int timeout = _remote_chann_timeout(tun, rc);
 
-               if (rc && rc->state==REMOTE_CHANN_STATE_CONNECTED) {
-                  int hlen = TUNNEL_CMD_CONST_HEADER_LEN;
-                  mnet_chann_send(rc->tcpout, tcmd.payload, tcmd.data_len - hlen);
-               }
-            }
-            else if (tcmd.cmd == TUNNEL_CMD_CONNECT) {
-               unsigned char *payload = tcmd.payload;
-               unsigned char addr_type = payload[0];
+   if (timeout <= 0) {
+      rc->deadline = 0;
+      return;
+   }
+
+   rc->deadline = time(NULL) + timeout;
+   if (rc->timer == NULL) {
+      rc->timer = mnet_timer_add(timeout * 1000, 0, _remote_chann_timer_cb, rc);
+      rc->timer_at = rc->deadline;
+   }
+   else if (rc->deadline < rc->timer_at) {
+      mnet_timer_reset(rc->timer, timeout * 1000);
+      rc->timer_at = rc->deadline;
+   }
+}
+
+/* description: client not authorized in time
+ */
+static void
+_remote_client_timer_cb(mnet_timer_t *t, void *ud) {
+   tun_remote_client_t *c = (tun_remote_client_t*)ud;
+   c->timer = NULL;             /* once timer freed after callback */
+   if (c->state != REMOTE_CLIENT_STATE_ACCEPT) {
+      _tun_remote()->expired.handshake++;
+      _err("client %p auth timeout\n", c);
+      _remote_client_destroy(c);
+   }
+}
 
-               int port = ((payload[1] & 0xff) << 8) | (payload[2] & 0xff);
-               /* _verbose("chann %d addr_type %d\n", tcmd.chann_id, addr_type); */
+/* description: one plain frame from client, return < 0 to destroy client
+ */
+static int
+_remote_client_cmd(unsigned char *frame, int frame_len, void *ud) {
+   tun_remote_client_t *c = (tun_remote_client_t*)ud;
+   tunnel_cmd_t tcmd = {0, 0, 0, 0, NULL, 0, 0};
 
-               if (addr_type == TUNNEL_ADDR_TYPE_IP) {
-                  char addr[TUNNEL_DNS_ADDR_LEN] = {0};
+   tunnel_cmd_parse(frame, frame_len, &tcmd);
+   if (tcmd.cmd<=TUNNEL_CMD_NONE || tcmd.cmd==TUNNEL_CMD_RECORD ||
+       tcmd.cmd>TUNNEL_CMD_DATA_LZ)
+   {
+      _err("client %p invalid cmd %d\n", c, tcmd.cmd);
+      return -1;
+   }
 
-                  strcpy(addr, (const char*)&payload[3]);
-                  _verbose("chann %d:%d try connect ip [%s:%d], %d\n", tcmd.chann_id,
-                           tcmd.magic, addr, port, strlen(addr));
+   c->data_mark++;
 
-                  tun_remote_chann_t *rc = _remote_chann_open(c, &tcmd, addr, port);
-                  if (rc == NULL) {
-                     _remote_send_connect_result(c, tcmd.chann_id, tcmd.magic, 0);
-                  }
-               }
-               else {
-                  char addr[TUNNEL_DNS_DOMAIN_LEN] = {0};
-                  char domain[TUNNEL_DNS_DOMAIN_LEN] = {0};
-
-                  strcpy(domain, (const char*)&payload[3]);
-                  _verbose("chann %d:%d query domain [%s:%d], %d\n", tcmd.chann_id,
-                           tcmd.magic, domain, port, strlen(addr));
-                  
-                  dns_query_t *query_entry = _dns_query_create(port, tcmd.chann_id, tcmd.magic, c);
-                  dns_query_domain(domain, strlen(domain), _remote_aux_dns_cb, query_entry);
+   if (tcmd.cmd == TUNNEL_CMD_ECHO) {
+      _remote_send_echo(c);
+      return 0;
+   }
+
+   /* _info("get cmd %d\n", tcmd.cmd); */
+   if (c->state == REMOTE_CLIENT_STATE_ACCEPT) {
+
+      if (tcmd.cmd==TUNNEL_CMD_DATA || tcmd.cmd==TUNNEL_CMD_DATA_LZ) {
+         tun_remote_chann_t *rc = _remote_chann_of_cmd(c, &tcmd);
+
+         /* data before connected cached, sent in SYN with fast open */
+         if (rc && (rc->state==REMOTE_CHANN_STATE_CONNECTED ||
+                    rc->state==REMOTE_CHANN_STATE_NONE))
+         {
+            unsigned char *payload = tcmd.payload;
+            int data_len = tcmd.data_len - TUNNEL_CMD_CONST_HEADER_LEN;
+            if (tcmd.cmd == TUNNEL_CMD_DATA_LZ) {
+               buf_t *zb = _tun_remote()->buflz;
+               payload = buf_addr(zb,0);
+               data_len = tunnel_lz_decompress(tcmd.payload, data_len, payload, buf_len(zb));
+               if (data_len < 0) {
+                  _err("client %p chann %d invalid lz block\n", c, rc->chann_id);
+                  return -1;
                }
             }
-            else if (tcmd.cmd == TUNNEL_CMD_CLOSE) {
-               tun_remote_chann_t *rc = _remote_chann_of_id_magic(c, tcmd.chann_id, tcmd.magic);
-               if (rc) {
-                  _remote_chann_closing(rc);
-               }
+            mnet_chann_send(rc->tcpout, payload, data_len);
+            _remote_chann_active(rc);
+            rc->recv_pending += data_len;
+            _remote_chann_grant(rc);
+         }
+      }
+      else if (tcmd.cmd == TUNNEL_CMD_WINDOW) {
+         tun_remote_chann_t *rc = _remote_chann_of_cmd(c, &tcmd);
+         if (rc && rc->state==REMOTE_CHANN_STATE_CONNECTED) {
+            rc->send_window += tunnel_cmd_window(tcmd.payload, 0, 0);
+            _remote_chann_recv_update(rc);
+         }
+      }
+      else if (tcmd.cmd == TUNNEL_CMD_CONNECT) {
+         unsigned char *payload = tcmd.payload;
+         int payload_len = tcmd.data_len - TUNNEL_CMD_CONST_HEADER_LEN;
+         unsigned char addr_type = payload[0];
+
+         int port = ((payload[1] & 0xff) << 8) | (payload[2] & 0xff);
+
+         /* local first bytes after addr */
+         int early_offset = 3 + strnlen((const char*)&payload[3], _MAX_OF(payload_len - 3, 0)) + 1;
+         int early_len = _MAX_OF(payload_len - early_offset, 0);
+         /* _verbose("chann %d addr_type %d\n", tcmd.chann_id, addr_type); */
+
+         if (addr_type == TUNNEL_ADDR_TYPE_IP) {
+            char addr[TUNNEL_DNS_ADDR_LEN] = {0};
+
+            strcpy(addr, (const char*)&payload[3]);
+            _verbose("chann %d:%d try connect ip [%s:%d], %d\n", tcmd.chann_id,
+                     tcmd.magic, addr, port, strlen(addr));
+
+            tun_remote_t *tun = _tun_remote();
+            int prio = tunnel_sched_class(tun->conf.sched_high, tun->conf.sched_low, addr, port);
+            tun_remote_chann_t *rc = _remote_chann_open(c, &tcmd, addr, port, prio);
+            if (rc == NULL) {
+               _remote_send_connect_result(c, tcmd.chann_id, tcmd.magic, 0);
+            }
+            else {
+               _remote_chann_early(rc, &payload[early_offset], early_len);
             }
          }
          else {
-            if (tcmd.cmd == TUNNEL_CMD_AUTH) {
-               unsigned char data[64] = {0};
-               int data_len = TUNNEL_CMD_CONST_HEADER_LEN + 1;
+            char addr[TUNNEL_DNS_DOMAIN_LEN] = {0};
+            char domain[TUNNEL_DNS_DOMAIN_LEN] = {0};
 
-               int auth_type = tcmd.payload[0];
+            strcpy(domain, (const char*)&payload[3]);
+            _verbose("chann %d:%d query domain [%s:%d], %d\n", tcmd.chann_id,
+                     tcmd.magic, domain, port, strlen(addr));
             
-               if (auth_type == 1) {
-                  char *username = (char*)&tcmd.payload[1];
-                  char *passwd = (char*)&tcmd.payload[17];
-
-                  tunnel_cmd_data_len(data, 1, data_len);
-                  tunnel_cmd_chann_id(data, 1, 0);
-                  tunnel_cmd_chann_magic(data, 1, 0);
-                  tunnel_cmd_head_cmd(data, 1, TUNNEL_CMD_AUTH);
-
-                  tun_remote_t *tun = _tun_remote();
-                  if (strncmp(tun->conf.username, username, 16)==0 &&
-                      strncmp(tun->conf.password, passwd, 16)==0)
-                  {
-                     c->state = REMOTE_CLIENT_STATE_ACCEPT;
-                     data[data_len - 1] = 1;
-                     _remote_send_front_data(c, data, data_len);
-                  }
-                  else {
-                     data[data_len - 1] = 0;
-                     _err("fail to auth <%s>, <%s>\n", username, passwd);
-                     _remote_client_destroy(c);
+            tun_remote_t *tun = _tun_remote();
+            int prio = tunnel_sched_class(tun->conf.sched_high, tun->conf.sched_low, domain, port);
+            dns_query_t *query_entry = _dns_query_create(port, tcmd.chann_id, tcmd.magic, prio,
+                                                         &payload[early_offset], early_len, c);
+            _remote_dns_query(domain, query_entry);
+         }
+      }
+      else if (tcmd.cmd == TUNNEL_CMD_CLOSE) {
+         tun_remote_chann_t *rc = _remote_chann_of_cmd(c, &tcmd);
+         if (rc) {
+            _remote_chann_closing(rc);
+         }
+      }
+   }
+   else {
+      if (tcmd.cmd == TUNNEL_CMD_AUTH) {
+         unsigned char data[64] = {0};
+         int hlen = TUNNEL_CMD_CONST_HEADER_LEN;
+         int data_len = hlen + 1 + 4 + 1 + 4;
+
+         int auth_type = tcmd.payload[0];
+      
+         if (auth_type == 1) {
+            char *username = (char*)&tcmd.payload[1];
+            char *passwd = (char*)&tcmd.payload[17];
+
+            tunnel_cmd_data_len(data, 1, data_len);
+            tunnel_cmd_chann_id(data, 1, 0);
+            tunnel_cmd_chann_magic(data, 1, 0);
+            tunnel_cmd_head_cmd(data, 1, TUNNEL_CMD_AUTH);
+
+            tun_remote_t *tun = _tun_remote();
+            if (strncmp(tun->conf.username, username, 16)==0 &&
+                strncmp(tun->conf.password, passwd, 16)==0)
+            {
+               c->state = REMOTE_CLIENT_STATE_ACCEPT;
+               if (c->timer) {
+                  mnet_timer_cancel(c->timer);
+                  c->timer = NULL;
+               }
+               if (tcmd.data_len >= hlen + 1 + 16 + 16 + 4) {
+                  c->peer_flow = 1;
+                  c->peer_window = tunnel_cmd_window(&tcmd.payload[33], 0, 0);
+               }
+               if (tcmd.data_len >= hlen + 1 + 16 + 16 + 4 + 1) {
+                  c->peer_record = (tcmd.payload[37] & TUNNEL_AUTH_FLAG_RECORD) != 0;
+                  c->peer_lz = (tcmd.payload[37] & TUNNEL_AUTH_FLAG_LZ) != 0;
+                  if (tun->conf.link_compact && (tcmd.payload[37] & TUNNEL_AUTH_FLAG_COMPACT)) {
+                     c->head = TUNNEL_CMD_HEAD_COMPACT;
                   }
                }
-               _verbose("(in) accept client %p, %d\n", c, auth_type);
+               if (tcmd.data_len >= hlen + 1 + 16 + 16 + 4 + 1 + 4) {
+                  int frame = tunnel_cmd_window(&tcmd.payload[38], 0, 0);
+                  c->frame_max = _MAX_OF(_MIN_OF(frame, tun->conf.frame_max), TUNNEL_CHANN_BUF_SIZE);
+               }
+               data[hlen] = 1;
+               tunnel_cmd_window(&data[hlen + 1], 1, tun->conf.chann_window);
+               data[hlen + 5] = TUNNEL_AUTH_FLAG_RECORD | TUNNEL_AUTH_FLAG_LZ | TUNNEL_AUTH_FLAG_COMPACT |
+                  TUNNEL_AUTH_FLAG_EARLY;
+               tunnel_cmd_window(&data[hlen + 6], 1, tun->conf.frame_max);
+               _remote_send_front_data(c, data, data_len);
             }
             else {
-               assert(0);
+               data[hlen] = 0;
+               _err("fail to auth <%s>, <%s>\n", username, passwd);
+               return -1;      /* client destroyed by caller */
             }
          }
-        reset_buffer:
-         buf_reset(ib);
+         _verbose("(in) accept client %p, %d\n", c, auth_type);
+      }
+      else {
+         assert(0);
       }
    }
+   return 0;
+}
+
+/* description: one frame from client, decoded in link buffer, RECORD
+ * unpacked to frames, return < 0 to destroy client
+ */
+static int
+_remote_client_frame(unsigned char *frame, int frame_len, void *ud) {
+   tun_remote_client_t *c = (tun_remote_client_t*)ud;
+   tunnel_cmd_t tcmd = {0, 0, 0, 0, NULL, 0, 0};
+
+   frame = _remote_recv_front_data(c, frame, &frame_len);
+   if (frame == NULL) {
+      return 0;
+   }
+   if ( !tunnel_cmd_parse(frame, frame_len, &tcmd) ) {
+      _err("client %p invalid frame length %d\n", c, frame_len);
+      return -1;
+   }
+
+   if (tcmd.cmd == TUNNEL_CMD_RECORD) {
+      int ret = tunnel_cmd_record_split(tcmd.head, tcmd.payload,
+                                        tcmd.data_len - TUNNEL_CMD_CONST_HEADER_LEN,
+                                        _remote_client_cmd, ud);
+      return (ret < 0) ? -1 : 0;
+   }
+   return _remote_client_cmd(frame, frame_len, ud);
+}
+
+void
+_remote_tcpin_cb(chann_event_t *e) {
+   tun_remote_client_t *c = (tun_remote_client_t*)e->opaque;
+   if (c->bufin == NULL) {
+      return;
+   }
+
+   if (e->event == MNET_EVENT_RECV) {
+      /* fill link buffer, then dispatch every complete frame, mnet repeats
+         RECV till drained or quantum */
+      buf_t *ib = c->bufin;
+      int ret = mnet_chann_recv(e->n, buf_addr(ib,buf_ptw(ib)), buf_available(ib));
+      if (ret <= 0) {
+         return;
+      }
+      buf_forward_ptw(ib, ret);
+
+      if (tunnel_cmd_decode(ib, _remote_client_frame, c) < 0) {
+         _err("client %p invalid frame or auth, destroy\n", c);
+         _remote_client_destroy(c);
+      }
+   }
+   else if (e->event == MNET_EVENT_SEND) {
+      c->sched_credit = 0;      /* unsent under low mark */
+      _remote_client_sched(c);
+   }
+   else if (e->event == MNET_EVENT_SEND_HIGH) {
+      _verbose("client %p over high mark, pause channs\n", c);
+      _remote_link_mark(c, 1);
+   }
+   else if (e->event == MNET_EVENT_SEND_LOW) {
+      _remote_link_mark(c, 0);
+   }
    else if (e->event == MNET_EVENT_CLOSE) {
       _verbose("client close event !\n");
       lst_pushl(_tun_remote()->leave_lst, c);
@@ -542,6 +1080,66 @@ _remote_buf_available(buf_t *b) {
    return (buf_available(b) - TUNNEL_CMD_CONST_HEADER_LEN);
 }
 
+/* description: DATA payload compressed to buflz when local accepts and
+ * sampled entropy low, return cmd of frame in data
+ */
+static int
+_remote_chann_compress(tun_remote_chann_t *rc, unsigned char **data, int *data_len) {
+   tun_remote_t *tun = _tun_remote();
+   tun_remote_client_t *c = (tun_remote_client_t*)rc->client;
+   int hlen = TUNNEL_CMD_CONST_HEADER_LEN;
+   int raw_len = *data_len - hlen;
+   unsigned char *raw = &(*data)[hlen];
+
+   if (!tun->conf.link_compress || !c->peer_lz || raw_len<TUNNEL_LZ_MIN_LEN) {
+      return TUNNEL_CMD_DATA;
+   }
+   if (rc->lz_skip > 0) {
+      rc->lz_skip--;
+      return TUNNEL_CMD_DATA;
+   }
+   if ( !tunnel_lz_worth(raw, raw_len) ) {
+      return TUNNEL_CMD_DATA;
+   }
+
+   /* worth it when 1/16 saved */
+   unsigned char *out = buf_addr(tun->buflz,0);
+   int len = tunnel_lz_compress(&tun->lz, raw, raw_len, &out[hlen], raw_len - raw_len/16);
+   if (len <= 0) {
+      rc->lz_skip = TUNNEL_LZ_SKIP;
+      return TUNNEL_CMD_DATA;
+   }
+   *data = out;
+   *data_len = hlen + len;
+   return TUNNEL_CMD_DATA_LZ;
+}
+
+/* description: DATA payload size for next read, chann buf size for
+ * interactive chann, doubled while reads fill it, limited by client frame
+ * and half local window
+ */
+static int
+_remote_chann_frame(tun_remote_chann_t *rc, int base) {
+   tun_remote_client_t *c = (tun_remote_client_t*)rc->client;
+   int limit = c->frame_max - 8 - TUNNEL_CMD_CONST_HEADER_LEN;
+   if (c->peer_window > 0) {
+      limit = _MIN_OF(limit, c->peer_window / 2);
+   }
+   if (rc->frame_size<base || rc->flow.prio==TUNNEL_SCHED_HIGH) {
+      rc->frame_size = base;
+   }
+   rc->frame_size = _MAX_OF(base, _MIN_OF(rc->frame_size, limit));
+   return rc->frame_size;
+}
+
+static void
+_remote_chann_connected(tun_remote_chann_t *rc) {
+   tun_remote_client_t *c = (tun_remote_client_t*)rc->client;
+   rc->state = REMOTE_CHANN_STATE_CONNECTED;
+   _remote_chann_active(rc);
+   _remote_send_connect_result(c, rc->chann_id, rc->magic, 1);
+}
+
 void
 _remote_tcpout_cb(chann_event_t *e) {
    tun_remote_chann_t *rc = (tun_remote_chann_t*)e->opaque;
@@ -555,30 +1153,66 @@ _remote_tcpout_cb(chann_event_t *e) {
       if (c->state == REMOTE_CLIENT_STATE_ACCEPT) {
          buf_t *ob = rc->bufout;
          int hlen = TUNNEL_CMD_CONST_HEADER_LEN;
-         int ret = mnet_chann_recv(e->n, buf_addr(ob,hlen), _remote_buf_available(ob) - hlen);
+         int base = _remote_buf_available(ob) - hlen;
+         int want = _remote_chann_frame(rc, base);
+         if (want > base) {
+            ob = _tun_remote()->bufbulk; /* frame copied or sent before reset */
+         }
+         if (c->peer_window > 0) {
+            want = _MIN_OF(want, rc->send_window);
+            if (want <= 0) {
+               _remote_chann_recv_update(rc);
+               return;
+            }
+         }
+         int ret = mnet_chann_recv(e->n, buf_addr(ob,hlen), want);
          if (ret <= 0) {
             return;
          }
          int data_len = ret + hlen;
          buf_forward_ptw(ob, data_len);
 
+         /* source has more for full read, short read back to small */
+         if (ret >= rc->frame_size) {
+            rc->frame_size *= 2;
+         } else if (ret < _MIN_OF(base, want)) {
+            rc->frame_size = base;
+         }
+
          unsigned char *data = buf_addr(ob,0);
+         int cmd = _remote_chann_compress(rc, &data, &data_len);
 
          tunnel_cmd_data_len(data, 1, data_len);
          tunnel_cmd_chann_id(data, 1, rc->chann_id);
          tunnel_cmd_chann_magic(data, 1, rc->magic);
-         tunnel_cmd_head_cmd(data, 1, TUNNEL_CMD_DATA);
+         tunnel_cmd_head_cmd(data, 1, cmd);
+
+         _remote_chann_send_data(rc, data, data_len);
+         _remote_chann_active(rc);
 
-         _remote_send_front_data(c, data, data_len);
+         if (c->peer_window > 0) {
+            rc->send_window -= ret;
+            if (rc->send_window <= 0) {
+               _remote_chann_recv_update(rc);
+            }
+         }
 
          buf_reset(ob);
       }
    }
+   else if (e->event == MNET_EVENT_SEND) {
+      _remote_chann_grant(rc);
+   }
+   else if (e->event == MNET_EVENT_SEND_HIGH) {
+      _remote_chann_mark(rc, 1);
+   }
+   else if (e->event == MNET_EVENT_SEND_LOW) {
+      _remote_chann_mark(rc, 0);
+   }
    else if (e->event == MNET_EVENT_CONNECT) {
       if (rc->state == REMOTE_CHANN_STATE_NONE) {
          _verbose("chann %d:%d connected\n", rc->chann_id, rc->magic);
-         rc->state = REMOTE_CHANN_STATE_CONNECTED;
-         _remote_send_connect_result(c, rc->chann_id, rc->magic, 1);
+         _remote_chann_connected(rc);
       }
    }
    else if (e->event == MNET_EVENT_DISCONNECT) {
@@ -602,9 +1236,12 @@ static void
 _remote_listen_cb(chann_event_t *e) {
    if (e->event == MNET_EVENT_ACCEPT) {
       tun_remote_t *tun = _tun_remote();
-      if (lst_count(tun->clients_lst) < 6) {
+      if (lst_count(tun->clients_lst) < TUNNEL_CLIENT_MAX_COUNT) {
          _remote_client_create(e->r);
       }
+      else {
+         mnet_chann_close(e->r);
+      }
    }
 }
 
@@ -629,12 +1266,21 @@ tunnel_remote_open(tunnel_remote_config_t *conf) {
 
       tun->tcpin = mnet_chann_open(CHANN_TYPE_STREAM);
       mnet_chann_set_cb(tun->tcpin, _remote_listen_cb, tun);
-      if (mnet_chann_listen_ex(tun->tcpin, conf->local_ipaddr, conf->local_port, 2) <= 0) {
+      if ( conf->fastopen ) {
+         mnet_chann_setopt(tun->tcpin, MNET_OPT_FASTOPEN, conf->backlog);
+      }
+      if (mnet_chann_listen_ex(tun->tcpin, conf->local_ipaddr, conf->local_port, conf->backlog) <= 0) {
          exit(1);
       }
 
-      tun->buftmp = buf_create(TUNNEL_CHANN_BUF_SIZE);
+      tun->buftmp = buf_create(TUNNEL_FRAME_MAX);
       assert(tun->buftmp);
+      tun->bufbulk = buf_create(TUNNEL_FRAME_MAX);
+      assert(tun->bufbulk);
+      tun->buflz = buf_create(TUNNEL_FRAME_MAX);
+      assert(tun->buflz);
+
+      tunnel_pool_init(&tun->pool, conf->pool_top, conf->pool_size, conf->pool_idle);
 
       tun->mode = conf->mode;
       tun->running = 1;
@@ -660,29 +1306,21 @@ tunnel_remote_close(void) {
 }
 #endif
 
+/* description: report every 60 s
+ */
 static void
-_remote_sig_timer(int sig) {
-   tun_remote_t *tun = _tun_remote();
-   tun->timer_active = 1;
+_remote_timer_cb(mnet_timer_t *t, void *ud) {
+   tun_remote_t *tun = (tun_remote_t*)ud;
+   mm_report(1);
+   _verbose("chann count %d, timeout auth %d, connect %d, idle %d\n",
+            mnet_report(0), tun->expired.handshake, tun->expired.connect,
+            tun->expired.idle);
 }
 
 static int
-_remote_install_sig_timer() {
-   struct itimerval tick;
-   tick.it_value.tv_sec = 60;
-   tick.it_value.tv_usec = 0;
-   tick.it_interval.tv_sec = 60; /* 60 s */
-   tick.it_interval.tv_usec = 0;
-   if (signal(SIGALRM, _remote_sig_timer) == SIG_ERR) {
-      fprintf(stderr, "Fail to install signal\n");
-      return 0;
-   }
-
-   if (setitimer(ITIMER_REAL, &tick, NULL) != 0) {
-      fprintf(stderr, "Fail to set timer\n");
-      return 0;
-   }
-   return 1;
+_remote_conf_int(conf_t *cf, const char *key, int def) {
+   str_t *value = utils_conf_value(cf, key);
+   return value ? atoi(str_cstr(value)) : def;
 }
 
 static void
@@ -730,6 +1368,55 @@ _remote_conf_get_values(tunnel_remote_config_t *conf, char *argv[]) {
       strncpy(conf->password, str_cstr(value), _MIN_OF(str_len(value), 32));
    }
 
+   value = utils_conf_value(cf, "NET_ENGINE");
+   if (str_cmp(value, "SELECT", 0) == 0) {
+      conf->engine = MNET_ENGINE_SELECT;
+   } else if (str_cmp(value, "EPOLL", 0) == 0) {
+      conf->engine = MNET_ENGINE_EPOLL;
+   } else if (str_cmp(value, "IOURING", 0) == 0) {
+      conf->engine = MNET_ENGINE_IOURING;
+   }
+
+   conf->connect_timeout = _remote_conf_int(cf, "CONNECT_TIMEOUT", 10);
+   conf->handshake_timeout = _remote_conf_int(cf, "HANDSHAKE_TIMEOUT", 10);
+   conf->idle_timeout = _remote_conf_int(cf, "IDLE_TIMEOUT", 600);
+   conf->backlog = _remote_conf_int(cf, "REMOTE_BACKLOG", 128);
+
+   value = utils_conf_value(cf, "LINK_BUFFER");
+   if (value == NULL) {
+      conf->link_buffer = 0;
+   } else if (str_cmp(value, "AUTO", 0) == 0) {
+      conf->link_buffer = -1;
+   } else {
+      conf->link_buffer = atoi(str_cstr(value));
+   }
+   conf->link_nodelay = _remote_conf_int(cf, "LINK_NODELAY", 1);
+   conf->link_cork = _remote_conf_int(cf, "LINK_CORK", 64*1024);
+   conf->link_record = _remote_conf_int(cf, "LINK_RECORD", TUNNEL_RECORD_MAX);
+   conf->link_compress = _remote_conf_int(cf, "LINK_COMPRESS", 0);
+   conf->link_compact = _remote_conf_int(cf, "LINK_COMPACT", 1);
+   conf->chann_window = _remote_conf_int(cf, "CHANN_WINDOW", TUNNEL_CHANN_WINDOW);
+   conf->frame_max = _remote_conf_int(cf, "FRAME_MAX", TUNNEL_FRAME_MAX);
+   conf->frame_max = _MAX_OF(_MIN_OF(conf->frame_max, TUNNEL_FRAME_MAX), TUNNEL_CHANN_BUF_SIZE);
+   conf->sched_lowat = _remote_conf_int(cf, "SCHED_LOWAT", 128*1024);
+
+   value = utils_conf_value(cf, "SCHED_HIGH");
+   if (value) {
+      strncpy(conf->sched_high, str_cstr(value), _MIN_OF(str_len(value), 127));
+   } else {
+      strcpy(conf->sched_high, "22,23,3389");
+   }
+   value = utils_conf_value(cf, "SCHED_LOW");
+   if (value) {
+      strncpy(conf->sched_low, str_cstr(value), _MIN_OF(str_len(value), 127));
+   }
+   conf->fastopen = _remote_conf_int(cf, "FASTOPEN", 0);
+   conf->pool_size = _remote_conf_int(cf, "POOL_SIZE", 0);
+   conf->pool_top = _remote_conf_int(cf, "POOL_TOP", 8);
+   conf->pool_idle = _remote_conf_int(cf, "POOL_IDLE", 30);
+   conf->recv_budget = _remote_conf_int(cf, "RECV_BUDGET", 1024*1024);
+   conf->recv_quantum = _remote_conf_int(cf, "RECV_QUANTUM", 64*1024);
+
    value = utils_conf_value(cf, "RUN_DAEMON");
    if (str_cmp(value, "YES", 0) == 0) {
       //daemon(1, 0);
@@ -752,11 +1439,6 @@ main(int argc, char *argv[]) {
 
    signal(SIGPIPE, SIG_IGN);
 
-   if (_remote_install_sig_timer() <= 0) {
-      fprintf(stderr, "[local] fail to install sig timer !\n");
-      return 0;
-   }
-
    tunnel_remote_config_t conf = {TUNNEL_REMOTE_MODE_INVALID, 0, 0, "", ""};
 
    _remote_conf_get_values(&conf, argv);
@@ -764,7 +1446,8 @@ main(int argc, char *argv[]) {
    if (conf.mode == TUNNEL_REMOTE_MODE_STANDALONE ||
        conf.mode == TUNNEL_REMOTE_MODE_FORWARD)
    {
-      mnet_init();
+      mnet_init_ex(conf.engine);
+      mnet_set_recv_budget(conf.recv_budget, conf.recv_quantum);
       stm_init();
       mthrd_init(MTHRD_MODE_POWER_HIGH);
 
@@ -773,6 +1456,8 @@ main(int argc, char *argv[]) {
 
          tun->key = mc_hash_key(conf.password, strlen(conf.password));
 
+         mnet_timer_add(60000, 60000, _remote_timer_cb, tun); /* 60 s */
+
          for (int i=0;;i++) {
 
             if (i > TUNNEL_CHANN_MAX_COUNT) {
@@ -794,6 +1479,7 @@ main(int argc, char *argv[]) {
             while (stm_count(tun->ip_stm) > 0) {
                dns_query_t *q = stm_popf(tun->ip_stm);
                tun_remote_client_t *c = q->opaque;
+               tun->dns_pending -= 1;
 
                int client_exist = 0;
 
@@ -816,10 +1502,11 @@ main(int argc, char *argv[]) {
                      is_connect = 0;
                   }
                   else {
-                     tun_remote_chann_t *rc = _remote_chann_open(c, &tcmd, q->addr, q->port);
+                     tun_remote_chann_t *rc = _remote_chann_open(c, &tcmd, q->addr, q->port, q->prio);
                      if (rc == NULL) {
                         is_connect = 0;
                      }
+                     _remote_chann_early(rc, q->early, q->early_len);
                   }
 
                   if ( !is_connect ) {
@@ -829,14 +1516,16 @@ main(int argc, char *argv[]) {
                
                _dns_query_destroy(q);
             }
+            if (tun->dns_pending<=0 && tun->dns_timer) {
+               mnet_timer_cancel(tun->dns_timer);
+               tun->dns_timer = NULL;
+            }
 
-
-            /* mem report */
-            if (tun->timer_active > 0) {
-               tun->timer_active = 0;
-               mm_report(1);
-               _verbose("chann count %d\n", mnet_report(0));
+            /* frames packed in this round */
+            lst_foreach(it, tun->clients_lst) {
+               _remote_client_flush((tun_remote_client_t*)lst_iter_data(it));
             }
+
          }
 
          //tunnel_remote_close();
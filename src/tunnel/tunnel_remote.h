@@ -22,6 +22,28 @@ typedef struct {
    char forward_ipaddr[16];   
    char username[32];
    char password[32];
+   int engine;                  /* mnet engine */
+   int connect_timeout;         /* in seconds, 0 to disable */
+   int handshake_timeout;
+   int idle_timeout;
+   int backlog;                 /* listen backlog */
+   int link_buffer;             /* bytes, 0 kernel default, -1 autotune */
+   int link_nodelay;
+   int link_cork;               /* batch link frames per poll, flush bytes */
+   int link_record;             /* pack small frames per poll, 0 disable */
+   int link_compress;           /* compress DATA to local accepting it */
+   int link_compact;            /* compact frame head to local accepting it */
+   int chann_window;            /* DATA bytes in flight per chann, 0 no limit */
+   int frame_max;               /* encoded frame limit, bulk DATA grows to */
+   int sched_lowat;             /* link unsent bytes for sched, 0 no sched */
+   char sched_high[128];        /* ports or domains interactive */
+   char sched_low[128];         /* ports or domains bulk */
+   int fastopen;                /* TCP Fast Open */
+   int pool_size;               /* tcpout connected ahead per hot dest, 0 disable */
+   int pool_top;                /* hot destinations kept warm */
+   int pool_idle;               /* seconds pooled tcpout kept */
+   int recv_budget;             /* bytes read in one poll, 0 unlimited */
+   int recv_quantum;            /* bytes read per chann in one poll */
 } tunnel_remote_config_t;
 
 int tunnel_remote_open(tunnel_remote_config_t*);
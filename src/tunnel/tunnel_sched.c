@@ -0,0 +1,230 @@
+/*
+ * Copyright (c) 2015 lalawue
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the MIT license. See LICENSE for details.
+ */
+
+#include "m_mem.h"
+#include "m_debug.h"
+#include "tunnel_sched.h"
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <assert.h>
+
+#define _err(...) _mlog("sched", D_ERROR, __VA_ARGS__)
+#define _info(...) _mlog("sched", D_INFO, __VA_ARGS__)
+#define _verbose(...) _mlog("sched", D_VERBOSE, __VA_ARGS__)
+
+struct s_sched_frame {
+   struct s_sched_frame *next;
+   int len;
+   unsigned char data[1];
+};
+
+static const int _sched_weight[TUNNEL_SCHED_CLASS_MAX] = { 4, 2, 1 };
+
+void
+tunnel_sched_init(tunnel_sched_t *s, tunnel_sched_send_cb send,
+                  tunnel_sched_drain_cb drain, void *ud)
+{
+   if (s) {
+      memset(s, 0, sizeof(*s));
+      s->send = send;
+      s->drain = drain;
+      s->ud = ud;
+   }
+}
+
+void
+tunnel_sched_flow_init(tunnel_sched_flow_t *f, int prio, void *ud) {
+   if (f) {
+      memset(f, 0, sizeof(*f));
+      f->prio = prio;
+      f->ud = ud;
+   }
+}
+
+static void
+_sched_ring_append(tunnel_sched_t *s, tunnel_sched_flow_t *f) {
+   f->next = NULL;
+   if (s->tail) {
+      s->tail->next = f;
+   } else {
+      s->head = f;
+   }
+   s->tail = f;
+}
+
+static void
+_sched_ring_remove(tunnel_sched_t *s, tunnel_sched_flow_t *f) {
+   tunnel_sched_flow_t *prev = NULL, *it = s->head;
+   while (it && it != f) {
+      prev = it;
+      it = it->next;
+   }
+   if (it) {
+      if (prev) {
+         prev->next = f->next;
+      } else {
+         s->head = f->next;
+      }
+      if (s->tail == f) {
+         s->tail = prev;
+      }
+   }
+   f->next = NULL;
+   f->active = 0;
+   f->deficit = 0;
+   f->turn = 0;
+}
+
+void
+tunnel_sched_push(tunnel_sched_t *s, tunnel_sched_flow_t *f,
+                  unsigned char *frame, int len)
+{
+   if (s && f && frame && len>0) {
+      tunnel_sched_frame_t *fr = (tunnel_sched_frame_t*)mm_malloc(sizeof(*fr) + len);
+      fr->len = len;
+      memcpy(fr->data, frame, len);
+      if (f->tail) {
+         f->tail->next = fr;
+      } else {
+         f->head = fr;
+      }
+      f->tail = fr;
+      f->bytes += len;
+      s->bytes += len;
+      if ( !f->active ) {
+         f->active = 1;
+         _sched_ring_append(s, f);
+      }
+   }
+}
+
+int
+tunnel_sched_run(tunnel_sched_t *s, int budget) {
+   int sent = 0;
+   if (s == NULL) {
+      return 0;
+   }
+
+   while (s->head && sent<budget) {
+      tunnel_sched_flow_t *f = s->head;
+      tunnel_sched_frame_t *fr = f->head;
+
+      if ( !f->turn ) {
+         f->deficit += TUNNEL_SCHED_QUANTUM * _sched_weight[f->prio];
+         f->turn = 1;
+      }
+
+      if (fr->len > f->deficit) {
+         /* turn over, deficit kept for next round */
+         f->turn = 0;
+         if (f != s->tail) {
+            s->head = f->next;
+            _sched_ring_append(s, f);
+         }
+         continue;
+      }
+
+      f->head = fr->next;
+      if (f->head == NULL) {
+         f->tail = NULL;
+      }
+      f->deficit -= fr->len;
+      f->bytes -= fr->len;
+      s->bytes -= fr->len;
+      sent += fr->len;
+
+      s->send(fr->data, fr->len, s->ud);
+      mm_free(fr);
+
+      if (f->head == NULL) {
+         _sched_ring_remove(s, f);
+         if ( s->drain ) {
+            s->drain(f);
+         }
+      }
+   }
+   return sent;
+}
+
+void
+tunnel_sched_flow_clear(tunnel_sched_t *s, tunnel_sched_flow_t *f) {
+   if (s && f) {
+      while ( f->head ) {
+         tunnel_sched_frame_t *fr = f->head;
+         f->head = fr->next;
+         mm_free(fr);
+      }
+      f->tail = NULL;
+      s->bytes -= f->bytes;
+      f->bytes = 0;
+      if ( f->active ) {
+         _sched_ring_remove(s, f);
+      }
+   }
+}
+
+void
+tunnel_sched_clear(tunnel_sched_t *s) {
+   while (s && s->head) {
+      tunnel_sched_flow_clear(s, s->head);
+   }
+}
+
+/* host ends with rule on label boundary, case insensitive */
+static int
+_sched_suffix(const char *host, const char *rule, int rlen) {
+   int hlen = (int)strlen(host);
+   if (rlen<=0 || hlen<rlen) {
+      return 0;
+   }
+   const char *h = &host[hlen - rlen];
+   for (int i=0; i<rlen; i++) {
+      if (tolower((unsigned char)h[i]) != tolower((unsigned char)rule[i])) {
+         return 0;
+      }
+   }
+   return (hlen==rlen || rule[0]=='.' || h[-1]=='.');
+}
+
+static int
+_sched_match(const char *rules, const char *host, int port) {
+   const char *p = rules;
+   while (p && *p) {
+      const char *e = strchr(p, ',');
+      int len = e ? (int)(e - p) : (int)strlen(p);
+      while (len>0 && isspace((unsigned char)*p)) {
+         p++; len--;
+      }
+      while (len>0 && isspace((unsigned char)p[len-1])) {
+         len--;
+      }
+      if (len > 0) {
+         if (isdigit((unsigned char)p[0])) {
+            if (atoi(p) == port) {
+               return 1;
+            }
+         }
+         else if (host && _sched_suffix(host, p, len)) {
+            return 1;
+         }
+      }
+      p = e ? e + 1 : NULL;
+   }
+   return 0;
+}
+
+int
+tunnel_sched_class(const char *high, const char *low, const char *host, int port) {
+   if ( _sched_match(high, host, port) ) {
+      return TUNNEL_SCHED_HIGH;
+   }
+   if ( _sched_match(low, host, port) ) {
+      return TUNNEL_SCHED_LOW;
+   }
+   return TUNNEL_SCHED_NORMAL;
+}
@@ -0,0 +1,72 @@
+/*
+ * Copyright (c) 2015 lalawue
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the MIT license. See LICENSE for details.
+ */
+
+#ifndef TUNNEL_SCHED_H
+#define TUNNEL_SCHED_H
+
+/* deficit round robin of chann frames onto one link, flow quantum weighted
+   by class */
+
+enum {
+   TUNNEL_SCHED_HIGH = 0,       /* interactive */
+   TUNNEL_SCHED_NORMAL,
+   TUNNEL_SCHED_LOW,            /* bulk */
+   TUNNEL_SCHED_CLASS_MAX,
+};
+
+#define TUNNEL_SCHED_QUANTUM  (8192)   /* bytes per round for weight 1 */
+#define TUNNEL_SCHED_FLOW_MAX (65536)  /* queued bytes, pause producer over */
+
+typedef struct s_sched_frame tunnel_sched_frame_t;
+
+typedef struct s_sched_flow {
+   struct s_sched_flow *next;   /* in active ring */
+   tunnel_sched_frame_t *head;
+   tunnel_sched_frame_t *tail;
+   int bytes;                   /* queued bytes */
+   int deficit;
+   int turn;                    /* quantum added this round */
+   int active;                  /* in active ring */
+   int prio;                    /* class */
+   void *ud;
+} tunnel_sched_flow_t;
+
+/* send frame to link, frame may be modified in place */
+typedef int (*tunnel_sched_send_cb)(unsigned char *frame, int len, void *ud);
+
+/* flow queue emptied by run */
+typedef void (*tunnel_sched_drain_cb)(tunnel_sched_flow_t *f);
+
+typedef struct {
+   tunnel_sched_flow_t *head;   /* active ring */
+   tunnel_sched_flow_t *tail;
+   int bytes;                   /* queued in all flows */
+   tunnel_sched_send_cb send;
+   tunnel_sched_drain_cb drain;
+   void *ud;
+} tunnel_sched_t;
+
+void tunnel_sched_init(tunnel_sched_t *s, tunnel_sched_send_cb send,
+                       tunnel_sched_drain_cb drain, void *ud);
+void tunnel_sched_flow_init(tunnel_sched_flow_t *f, int prio, void *ud);
+
+/* queue a copy of frame at flow tail */
+void tunnel_sched_push(tunnel_sched_t *s, tunnel_sched_flow_t *f,
+                       unsigned char *frame, int len);
+
+/* send frames till budget bytes reached, return bytes sent */
+int tunnel_sched_run(tunnel_sched_t *s, int budget);
+
+/* drop queued frames of flow, or all flows */
+void tunnel_sched_flow_clear(tunnel_sched_t *s, tunnel_sched_flow_t *f);
+void tunnel_sched_clear(tunnel_sched_t *s);
+
+/* class of destination, rules are ',' separated ports or domain suffixes,
+   high rules checked first */
+int tunnel_sched_class(const char *high, const char *low, const char *host, int port);
+
+#endif